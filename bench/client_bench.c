@@ -0,0 +1,133 @@
+/* Measures the latency clients see from a real MMU as the number of
+ * connected clients grows.  Starts bin/mmu with one frame for every
+ * eight clients, then forks the clients; once all are connected, each
+ * writes to its single page once a millisecond.  Frames are scarce,
+ * so most writes fault, and the time a write takes includes the
+ * fault's round trip to the MMU and the wait for a free worker.
+ * NCLIENTS defaults to 200.  Arguments after the first two are passed
+ * to bin/mmu (e.g., -w 4).
+ *
+ * usage: client_bench [NCLIENTS [NWRITES [MMU ARGUMENT]...]] */
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "uvm.h"
+
+#define BENCH_MMU "./bin/mmu"
+#define BENCH_MAXARGS 32
+#define BENCH_MAXCLIENTS 1024 /* a page each, and the MMU has 1024 blocks */
+#define BENCH_THINK_US 1000
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* Connects, tells the parent through `ready`, waits for `go` to be
+ * closed, then times `nwrites` writes into `samples`. */
+static void bench_client(int ready, int go, int nwrites, uint64_t *samples)
+{
+	uvm_create();
+	volatile char *page = uvm_extend();
+	if(page == NULL) exit(EXIT_FAILURE);
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	char c = 0;
+	if(write(ready, &c, 1) != 1 || read(go, &c, 1) != 0)
+		exit(EXIT_FAILURE);
+	for(int i = 0; i < nwrites; i++) {
+		uint64_t start = bench_now();
+		page[(i * 64) % pagesz] = (char)i;
+		samples[i] = bench_now() - start;
+		usleep(BENCH_THINK_US);
+	}
+	exit(EXIT_SUCCESS);
+}
+
+int main(int argc, char **argv)
+{
+	int nclients = argc > 1 ? atoi(argv[1]) : 200;
+	int nwrites = argc > 2 ? atoi(argv[2]) : 100;
+	if(nclients < 16 || nclients > BENCH_MAXCLIENTS || nwrites < 1 || argc - 3 > BENCH_MAXARGS - 4) {
+		fprintf(stderr, "usage: %s [NCLIENTS [NWRITES [MMU ARGUMENT]...]]\n",
+				argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	char frames[16], blocks[16];
+	snprintf(frames, sizeof(frames), "%d", nclients / 8);
+	snprintf(blocks, sizeof(blocks), "%d", nclients);
+	char *mmu_argv[BENCH_MAXARGS];
+	int n = 0;
+	mmu_argv[n++] = BENCH_MMU;
+	for(int i = 3; i < argc; i++) mmu_argv[n++] = argv[i];
+	mmu_argv[n++] = frames;
+	mmu_argv[n++] = blocks;
+	mmu_argv[n] = NULL;
+	pid_t mmu = fork();
+	if(mmu == 0) {
+		if(freopen("/dev/null", "w", stdout) == NULL) exit(EXIT_FAILURE);
+		execv(BENCH_MMU, mmu_argv);
+		perror(BENCH_MMU);
+		exit(EXIT_FAILURE);
+	}
+	sleep(1);
+
+	size_t total = (size_t)nclients * nwrites;
+	uint64_t *samples = mmap(NULL, total * sizeof(uint64_t),
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	int ready[2], go[2];
+	if(samples == MAP_FAILED || pipe(ready) || pipe(go)) {
+		perror("client_bench");
+		exit(EXIT_FAILURE);
+	}
+	for(int i = 0; i < nclients; i++) {
+		if(fork() == 0) {
+			close(ready[0]);
+			close(go[1]);
+			bench_client(ready[1], go[0], nwrites,
+					samples + (size_t)i * nwrites);
+		}
+	}
+	close(ready[1]);
+	close(go[0]);
+	int nready = 0;
+	char c;
+	while(nready < nclients && read(ready[0], &c, 1) == 1) nready++;
+	uint64_t start = bench_now();
+	close(go[1]);
+	int failed = 0;
+	for(int i = 0; i < nclients; i++) {
+		int status;
+		wait(&status);
+		if(!WIFEXITED(status) || WEXITSTATUS(status)) failed++;
+	}
+	double secs = (bench_now() - start) / 1e9;
+	kill(mmu, SIGINT);
+	waitpid(mmu, NULL, 0);
+
+	qsort(samples, total, sizeof(uint64_t), bench_cmp);
+	printf("%d clients (%d connected, %d failed) %d writes each: %.2fs\n",
+			nclients, nready, failed, nwrites, secs);
+	printf("write latency p50 %.1f p99 %.1f p999 %.1f max %.1f us\n",
+			samples[total / 2] / 1e3, samples[total * 99 / 100] / 1e3,
+			samples[total * 999 / 1000] / 1e3, samples[total - 1] / 1e3);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,75 @@
+/* Measures the cost of clock victim selection as memory grows.
+ * Faults go to random pages of twice as many pages as there are
+ * frames, so most faults evict and the hand sweeps over frames that
+ * were referenced since its last pass.  The cost per fault should
+ * grow much slower than the number of frames.  With PROTVEC set to 1
+ * the pager's `protvec` option is on, and the access a sweep revokes
+ * takes one message per process instead of one per frame; msgs/evict
+ * counts the protection change messages sent per eviction.
+ *
+ * usage: clock_bench [NFAULTS [PROTVEC]] */
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "pager.h"
+#include "mmustub.h"
+
+#define BENCH_PAGES_PER_PROC 128
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+	int nfaults = argc > 1 ? atoi(argv[1]) : 200000;
+	if(argc > 2) pager_option("protvec", argv[2]);
+	int steps[] = {256, 1024, 4096, 16384, 65536};
+	pid_t pid = 1;
+
+	printf("%8s %12s %12s %12s %12s\n", "frames", "faults", "chprot/evict",
+			"msgs/evict", "ns/fault");
+	for(int s = 0; s < sizeof(steps)/sizeof(steps[0]); s++) {
+		int nframes = steps[s];
+		int nprocs = 2 * nframes / BENCH_PAGES_PER_PROC;
+		pid_t first = pid;
+		mmustub_init(nframes);
+		pager_init(nframes, 2 * nframes + 1);
+		for(int p = 0; p < nprocs; p++, pid++) {
+			pager_create(pid);
+			for(int i = 0; i < BENCH_PAGES_PER_PROC; i++)
+				pager_extend(pid);
+		}
+		srand(1);
+		struct mmustub_counters before = mmustub;
+		double start = now();
+		for(int i = 0; i < nfaults; i++) {
+			int page = rand() % BENCH_PAGES_PER_PROC;
+			pid_t victim = first + rand() % nprocs;
+			pager_fault(victim, (char *)UVM_BASEADDR +
+					page * sysconf(_SC_PAGESIZE));
+		}
+		double elapsed = now() - start;
+		long evictions = mmustub.nonresident - before.nonresident;
+		printf("%8d %12d %12.1f %12.1f %12.1f\n", nframes, nfaults,
+				evictions ? (double)(mmustub.chprot - before.chprot)
+						/ evictions : 0.0,
+				evictions ? (double)(mmustub.prot_msgs - before.prot_msgs)
+						/ evictions : 0.0,
+				elapsed * 1e9 / nfaults);
+		for(pid_t p = first; p < pid; p++)
+			pager_destroy(p);
+		free((void *)pmem);
+	}
+	return 0;
+}
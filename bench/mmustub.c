@@ -0,0 +1,156 @@
+/* Stub MMU used by the pager benchmarks.  It implements the
+ * interface in mmu.h without clients or sockets: protection changes
+ * and disk copies are only counted, so benchmarks measure the cost
+ * of the pager's own bookkeeping. */
+
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "mmustub.h"
+
+const char *pmem = NULL;
+struct mmustub_counters mmustub;
+
+/* Protection of each page, per process, as the MMU last set it. */
+#define STUB_MAXPROCS 64
+#define STUB_MAXPAGES 256
+static struct {
+	pid_t pid;
+	int prot[STUB_MAXPAGES];
+} stub_procs[STUB_MAXPROCS];
+
+static int *stub_prot(pid_t pid, void *vaddr)
+{
+	long page = ((intptr_t)vaddr - UVM_BASEADDR) / sysconf(_SC_PAGESIZE);
+	int i = (unsigned)pid % STUB_MAXPROCS;
+	if(stub_procs[i].pid != pid) {
+		stub_procs[i].pid = pid;
+		for(int p = 0; p < STUB_MAXPAGES; p++)
+			stub_procs[i].prot[p] = PROT_NONE;
+	}
+	return &stub_procs[i].prot[page % STUB_MAXPAGES];
+}
+
+int mmustub_prot(pid_t pid, void *vaddr)
+{
+	return *stub_prot(pid, vaddr);
+}
+
+void mmustub_init(int nframes)
+{
+	pmem = calloc(nframes, sysconf(_SC_PAGESIZE));
+}
+
+/* Sleeps for `mmustub.rtt_ns` to stand in for the socket round trip
+ * to the client, during which the MMU thread is blocked in recv. */
+static void mmustub_rtt(void)
+{
+	if(mmustub.rtt_ns == 0) return;
+	struct timespec ts = { mmustub.rtt_ns / 1000000000L,
+			mmustub.rtt_ns % 1000000000L };
+	nanosleep(&ts, NULL);
+}
+
+void mmu_zero_fill(int frame) { __sync_fetch_and_add(&mmustub.zero_fill, 1); }
+
+void mmu_resident(pid_t pid, void *vaddr, int frame, int prot)
+{
+	__sync_fetch_and_add(&mmustub.resident, 1);
+	__sync_fetch_and_add(&mmustub.prot_msgs, 1);
+	*stub_prot(pid, vaddr) = prot;
+	mmustub_rtt();
+}
+
+void mmu_nonresident(pid_t pid, void *vaddr)
+{
+	__sync_fetch_and_add(&mmustub.nonresident, 1);
+	__sync_fetch_and_add(&mmustub.prot_msgs, 1);
+	*stub_prot(pid, vaddr) = PROT_NONE;
+	mmustub_rtt();
+}
+
+void mmu_chprot(pid_t pid, void *vaddr, int prot)
+{
+	__sync_fetch_and_add(&mmustub.chprot, 1);
+	__sync_fetch_and_add(&mmustub.prot_msgs, 1);
+	*stub_prot(pid, vaddr) = prot;
+	mmustub_rtt();
+}
+
+void mmu_resident_vec(pid_t pid, void * const *vaddrs, const int *frames,
+		const int *prots, int n)
+{
+	__sync_fetch_and_add(&mmustub.resident, n);
+	__sync_fetch_and_add(&mmustub.prot_msgs, 1);
+	for(int i = 0; i < n; i++)
+		*stub_prot(pid, vaddrs[i]) = prots[i];
+	mmustub_rtt();
+}
+
+void mmu_chprot_vec(pid_t pid, void * const *vaddrs, const int *prots, int n)
+{
+	__sync_fetch_and_add(&mmustub.chprot, n);
+	__sync_fetch_and_add(&mmustub.prot_msgs, 1);
+	for(int i = 0; i < n; i++)
+		*stub_prot(pid, vaddrs[i]) = prots[i];
+	mmustub_rtt();
+}
+
+void mmu_sync(pid_t pid)
+{
+}
+
+void mmu_resume(pid_t pid)
+{
+}
+
+/* Counts a transfer of `n` blocks from `block`, and a seek if the
+ * disk head was elsewhere.  The head position is not updated
+ * atomically, so seeks are only exact with one faulting thread. */
+static void stub_transfer(int block, int n)
+{
+	static int head = -1;
+	__sync_fetch_and_add(&mmustub.disk_transfers, 1);
+	if(block != head)
+		__sync_fetch_and_add(&mmustub.disk_seeks, 1);
+	head = block + n;
+}
+
+void mmu_disk_read(int block_from, int frame_to)
+{
+	__sync_fetch_and_add(&mmustub.disk_read, 1);
+	stub_transfer(block_from, 1);
+}
+
+void mmu_disk_write(int frame_from, int block_to)
+{
+	__sync_fetch_and_add(&mmustub.disk_write, 1);
+	stub_transfer(block_to, 1);
+}
+
+void mmu_disk_read_vec(int block_from, const int *frames_to, int n)
+{
+	__sync_fetch_and_add(&mmustub.disk_read, n);
+	stub_transfer(block_from, n);
+}
+
+void mmu_disk_write_vec(const int *frames_from, int block_to, int n)
+{
+	__sync_fetch_and_add(&mmustub.disk_write, n);
+	stub_transfer(block_to, n);
+}
+
+/* The compressed pool is not simulated: every store is rejected, so
+ * pages go to disk as without zswap. */
+void mmu_zswap_init(int npages) { }
+int mmu_zswap_store(int frame) { return -1; }
+void mmu_zswap_load(int handle, int frame) { }
+void mmu_zswap_free(int handle) { }
+
+void mmu_copy_frame(int frame_from, int frame_to) { }
@@ -0,0 +1,31 @@
+/* Stub MMU for pager benchmarks; see mmustub.c. */
+
+#ifndef __MMUSTUB_HEADER__
+#define __MMUSTUB_HEADER__
+
+#include <sys/types.h>
+
+struct mmustub_counters {
+	long zero_fill;
+	long resident;
+	long nonresident;
+	long chprot;
+	long prot_msgs; /* single and vector protection changes */
+	long disk_read;
+	long disk_write;
+	long disk_transfers; /* single and vector disk operations */
+	long disk_seeks; /* transfers not starting where the last ended */
+	long rtt_ns; /* simulated client round trip, 0 by default */
+};
+
+extern struct mmustub_counters mmustub;
+
+/* `mmustub_init` allocates a fake `pmem` with `nframes` frames. */
+void mmustub_init(int nframes);
+
+/* `mmustub_prot` returns the protection the pager last installed for
+ * page `vaddr` of `pid`.  Protections are only tracked for a few
+ * dozen processes with distinct pids modulo 64. */
+int mmustub_prot(pid_t pid, void *vaddr);
+
+#endif
@@ -0,0 +1,61 @@
+/* Measures pager_fault cost as the number of registered processes
+ * grows.  Each process owns one page; faults go to processes picked
+ * at random, so with few frames most faults evict a page owned by
+ * some other process.  The cost per fault should not depend on how
+ * many processes are registered.
+ *
+ * usage: pager_bench [NFAULTS] */
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mmu.h"
+#include "pager.h"
+#include "mmustub.h"
+
+#define BENCH_NFRAMES 64
+#define BENCH_MAXPROCS 8192
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static pid_t bench_pid(int i)
+{
+	return 1000 + i * 7;
+}
+
+int main(int argc, char **argv)
+{
+	int nfaults = argc > 1 ? atoi(argv[1]) : 1000000;
+	int steps[] = {1, 16, 256, 1024, 4096, BENCH_MAXPROCS};
+	int nprocs = 0;
+
+	mmustub_init(BENCH_NFRAMES);
+	pager_init(BENCH_NFRAMES, BENCH_MAXPROCS);
+	srand(1);
+
+	printf("%8s %12s %12s\n", "procs", "faults", "ns/fault");
+	for(int s = 0; s < sizeof(steps)/sizeof(steps[0]); s++) {
+		for(; nprocs < steps[s]; nprocs++) {
+			pager_create(bench_pid(nprocs));
+			pager_extend(bench_pid(nprocs));
+		}
+		double start = now();
+		for(int i = 0; i < nfaults; i++) {
+			pid_t pid = bench_pid(rand() % nprocs);
+			pager_fault(pid, (void *)UVM_BASEADDR);
+		}
+		double elapsed = now() - start;
+		printf("%8d %12d %12.1f\n", nprocs, nfaults,
+				elapsed * 1e9 / nfaults);
+	}
+	return 0;
+}
@@ -0,0 +1,82 @@
+/* Runs concurrent clients against the pager and reports fault
+ * throughput as the number of client threads grows.  Each thread
+ * plays one process faulting on its own resident pages, as the MMU's
+ * workers do.  Protection changes cost a simulated client
+ * round trip, so throughput only scales if faults from different
+ * processes are serviced in parallel.
+ *
+ * usage: pager_stress [SECONDS [RTT_NS]] */
+
+#include <sys/types.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "pager.h"
+#include "mmustub.h"
+
+#define STRESS_MAXTHREADS 16
+#define STRESS_PAGES 8
+
+static volatile int stress_running;
+
+static void *stress_client(void *arg)
+{
+	pid_t pid = (pid_t)(intptr_t)arg;
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	long faults = 0;
+	while(stress_running) {
+		char *vaddr = (char *)UVM_BASEADDR + (faults % STRESS_PAGES) * pagesz;
+		pager_fault(pid, vaddr);
+		faults++;
+	}
+	return (void *)faults;
+}
+
+int main(int argc, char **argv)
+{
+	double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+	mmustub.rtt_ns = argc > 2 ? atol(argv[2]) : 2000;
+	int nframes = STRESS_MAXTHREADS * STRESS_PAGES;
+	pid_t nextpid = 1000;
+
+	mmustub_init(nframes);
+	pager_init(nframes, nframes);
+
+	printf("%8s %14s %12s\n", "threads", "faults/s", "speedup");
+	double base = 0;
+	for(int nthreads = 1; nthreads <= STRESS_MAXTHREADS; nthreads *= 2) {
+		pthread_t threads[STRESS_MAXTHREADS];
+		pid_t pids[STRESS_MAXTHREADS];
+		for(int t = 0; t < nthreads; t++) {
+			pids[t] = nextpid++;
+			pager_create(pids[t]);
+			for(int p = 0; p < STRESS_PAGES; p++) {
+				pager_extend(pids[t]);
+				pager_fault(pids[t], (char *)UVM_BASEADDR + p * sysconf(_SC_PAGESIZE));
+			}
+		}
+		stress_running = 1;
+		for(int t = 0; t < nthreads; t++)
+			pthread_create(&threads[t], NULL, stress_client,
+					(void *)(intptr_t)pids[t]);
+		usleep((useconds_t)(seconds * 1e6));
+		stress_running = 0;
+		long total = 0;
+		for(int t = 0; t < nthreads; t++) {
+			void *faults;
+			pthread_join(threads[t], &faults);
+			total += (long)faults;
+			pager_destroy(pids[t]);
+		}
+		double rate = total / seconds;
+		if(nthreads == 1) base = rate;
+		printf("%8d %14.0f %12.2f\n", nthreads, rate, rate / base);
+	}
+	return 0;
+}
@@ -0,0 +1,111 @@
+/* Compares replacement policies on synthetic workloads.  Accesses are
+ * simulated against the protections the pager installs in the stub
+ * MMU, so a page faults exactly when the real client would.  Reports
+ * faults and disk traffic per policy and workload.
+ *
+ * usage: policy_bench [NACCESSES] */
+
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "pager.h"
+#include "policy.h"
+#include "mmustub.h"
+
+#define BENCH_NFRAMES 32
+#define BENCH_NBLOCKS 256
+#define BENCH_WRITE_PCT 25
+
+struct workload {
+	const char *name;
+	int npages;
+	int (*next)(int i, int npages);
+};
+
+/* Cyclic scan slightly larger than memory. */
+static int loop_next(int i, int npages)
+{
+	return i % npages;
+}
+
+/* A hot set of half of memory gets 80% of accesses; the rest scans a
+ * large cold region. */
+static int hotscan_next(int i, int npages)
+{
+	static int scan = 0;
+	int hot = BENCH_NFRAMES / 2;
+	if(rand() % 100 < 80) return rand() % hot;
+	scan = (scan + 1) % (npages - hot);
+	return hot + scan;
+}
+
+/* Skewed random accesses: low pages are much more popular. */
+static int skewed_next(int i, int npages)
+{
+	double r = (double)rand() / RAND_MAX;
+	return (int)(r * r * r * npages) % npages;
+}
+
+static struct workload workloads[] = {
+	{ "loop", BENCH_NFRAMES + BENCH_NFRAMES / 4, loop_next },
+	{ "hotscan", BENCH_NFRAMES / 2 + 4 * BENCH_NFRAMES, hotscan_next },
+	{ "skewed", 4 * BENCH_NFRAMES, skewed_next },
+};
+
+static void bench_access(pid_t pid, int page, int write)
+{
+	char *vaddr = (char *)UVM_BASEADDR + page * sysconf(_SC_PAGESIZE);
+	int need = write ? PROT_READ | PROT_WRITE : PROT_READ;
+	for(int tries = 0; (mmustub_prot(pid, vaddr) & need) != need; tries++) {
+		if(tries == 3) {
+			fprintf(stderr, "page %d does not become accessible\n", page);
+			exit(EXIT_FAILURE);
+		}
+		pager_fault(pid, vaddr);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int naccesses = argc > 1 ? atoi(argv[1]) : 200000;
+	char names[256];
+	pid_t pid = 1;
+
+	mmustub_init(BENCH_NFRAMES);
+	printf("%-10s %-10s %10s %10s %10s\n", "workload", "policy",
+			"faults", "reads", "writes");
+	for(int w = 0; w < sizeof(workloads)/sizeof(workloads[0]); w++) {
+		strncpy(names, policy_names, sizeof(names) - 1);
+		for(char *p = strtok(names, " "); p; p = strtok(NULL, " ")) {
+			struct mmustub_counters before = mmustub;
+			long faults = 0;
+			pager_option("policy", p);
+			pager_init(BENCH_NFRAMES, BENCH_NBLOCKS);
+			pager_create(++pid);
+			for(int i = 0; i < workloads[w].npages; i++)
+				pager_extend(pid);
+			srand(1);
+			for(int i = 0; i < naccesses; i++) {
+				int page = workloads[w].next(i, workloads[w].npages);
+				int write = rand() % 100 < BENCH_WRITE_PCT;
+				long resident = mmustub.resident + mmustub.chprot;
+				bench_access(pid, page, write);
+				if(mmustub.resident + mmustub.chprot != resident)
+					faults++;
+			}
+			pager_destroy(pid);
+			printf("%-10s %-10s %10ld %10ld %10ld\n", workloads[w].name,
+					p, faults,
+					mmustub.disk_read - before.disk_read,
+					mmustub.disk_write - before.disk_write);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,91 @@
+/* Measures how many disk transfers and seeks swapping takes with and
+ * without swap clusters.  Processes allocate their pages interleaved,
+ * then in turn write all their pages and read them back sequentially,
+ * so each one pushes the previous one's pages out to disk.  Without
+ * clusters a process's blocks are scattered and every page is its
+ * own transfer; with them, neighbouring pages are written and read
+ * ahead together.
+ *
+ * usage: swap_bench [NROUNDS] */
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "pager.h"
+#include "mmustub.h"
+
+#define BENCH_NFRAMES 64
+#define BENCH_NBLOCKS 1024
+#define BENCH_NPROCS 8
+#define BENCH_NPAGES 64
+
+static void bench_access(pid_t pid, int page, int write)
+{
+	char *vaddr = (char *)UVM_BASEADDR + page * sysconf(_SC_PAGESIZE);
+	int need = write ? PROT_READ | PROT_WRITE : PROT_READ;
+	for(int tries = 0; (mmustub_prot(pid, vaddr) & need) != need; tries++) {
+		if(tries == 3) {
+			fprintf(stderr, "page %d does not become accessible\n", page);
+			exit(EXIT_FAILURE);
+		}
+		pager_fault(pid, vaddr);
+	}
+}
+
+/* Runs the workload in a fresh pager with swap clusters of `cluster`
+ * blocks (0 for none); runs in a child, as options only apply at
+ * `pager_init`. */
+static void bench_run(int cluster, int nrounds)
+{
+	char value[16];
+	snprintf(value, sizeof(value), "%d", cluster);
+	pager_option("swapcluster", value);
+	pager_option("readahead", "16");
+	pager_option("lowmark", "8");
+	pager_option("highmark", "24");
+	mmustub_init(BENCH_NFRAMES);
+	pager_init(BENCH_NFRAMES, BENCH_NBLOCKS);
+	for(int p = 0; p < BENCH_NPROCS; p++)
+		pager_create(p + 1);
+	for(int i = 0; i < BENCH_NPAGES; i++)
+		for(int p = 0; p < BENCH_NPROCS; p++)
+			pager_extend(p + 1);
+
+	for(int r = 0; r < nrounds; r++) {
+		for(int p = 0; p < BENCH_NPROCS; p++) {
+			for(int i = 0; i < BENCH_NPAGES; i++)
+				bench_access(p + 1, i, 1);
+			for(int i = 0; i < BENCH_NPAGES; i++)
+				bench_access(p + 1, i, 0);
+		}
+	}
+	printf("%8d %10ld %10ld %10ld %10ld\n", cluster, mmustub.disk_read,
+			mmustub.disk_write, mmustub.disk_transfers,
+			mmustub.disk_seeks);
+}
+
+int main(int argc, char **argv)
+{
+	int nrounds = argc > 1 ? atoi(argv[1]) : 10;
+	int clusters[] = {0, 4, 16, 64};
+
+	printf("%8s %10s %10s %10s %10s\n", "cluster", "reads", "writes",
+			"transfers", "seeks");
+	fflush(stdout);
+	for(int c = 0; c < sizeof(clusters)/sizeof(clusters[0]); c++) {
+		pid_t child = fork();
+		if(child == 0) {
+			bench_run(clusters[c], nrounds);
+			exit(EXIT_SUCCESS);
+		}
+		waitpid(child, NULL, 0);
+	}
+	return 0;
+}
@@ -0,0 +1,123 @@
+/* Compares the round-trip latency clients of a real MMU see over the
+ * socket and over shared-memory rings (UVM_TRANSPORT=ring).  Starts
+ * bin/mmu with a single frame, then runs one client per transport,
+ * one after the other.  Each client times NROUNDS quota requests,
+ * which the MMU answers without touching memory, and NROUNDS writes
+ * alternating between two pages, each of which faults and evicts the
+ * other page.  Arguments after the first are passed to bin/mmu.
+ *
+ * usage: transport_bench [NROUNDS [MMU ARGUMENT]...] */
+
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "uvm.h"
+
+#define BENCH_MMU "./bin/mmu"
+#define BENCH_MAXARGS 32
+
+static const char *bench_transports[] = { "socket", "ring" };
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* Times `nrounds` quota requests into `quota` and as many faulting
+ * writes into `fault`. */
+static void bench_client(int nrounds, uint64_t *quota, uint64_t *fault)
+{
+	uvm_create();
+	volatile char *pages = uvm_extend_n(2);
+	if(pages == NULL) exit(EXIT_FAILURE);
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	for(int i = 0; i < nrounds; i++) {
+		uint64_t start = bench_now();
+		if(uvm_set_quota(0, 0)) exit(EXIT_FAILURE);
+		quota[i] = bench_now() - start;
+	}
+	for(int i = 0; i < nrounds; i++) {
+		uint64_t start = bench_now();
+		pages[(i % 2) * pagesz] = (char)i;
+		fault[i] = bench_now() - start;
+	}
+	exit(EXIT_SUCCESS);
+}
+
+static void bench_print(const char *what, uint64_t *samples, int n)
+{
+	qsort(samples, n, sizeof(uint64_t), bench_cmp);
+	printf("  %-6s p50 %7.1f p99 %7.1f max %8.1f us\n", what,
+			samples[n / 2] / 1e3, samples[n * 99 / 100] / 1e3,
+			samples[n - 1] / 1e3);
+}
+
+int main(int argc, char **argv)
+{
+	int nrounds = argc > 1 ? atoi(argv[1]) : 10000;
+	if(nrounds < 100 || argc - 2 > BENCH_MAXARGS - 4) {
+		fprintf(stderr, "usage: %s [NROUNDS [MMU ARGUMENT]...]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	char *mmu_argv[BENCH_MAXARGS];
+	int n = 0;
+	mmu_argv[n++] = BENCH_MMU;
+	for(int i = 2; i < argc; i++) mmu_argv[n++] = argv[i];
+	mmu_argv[n++] = "1";
+	mmu_argv[n++] = "8";
+	mmu_argv[n] = NULL;
+	pid_t mmu = fork();
+	if(mmu == 0) {
+		if(freopen("/dev/null", "w", stdout) == NULL) exit(EXIT_FAILURE);
+		execv(BENCH_MMU, mmu_argv);
+		perror(BENCH_MMU);
+		exit(EXIT_FAILURE);
+	}
+	sleep(1);
+
+	uint64_t *samples = mmap(NULL, 2 * nrounds * sizeof(uint64_t),
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(samples == MAP_FAILED) {
+		perror("transport_bench");
+		exit(EXIT_FAILURE);
+	}
+	int failed = 0;
+	for(size_t t = 0; t < sizeof(bench_transports) / sizeof(*bench_transports); t++) {
+		setenv("UVM_TRANSPORT", bench_transports[t], 1);
+		fflush(stdout);
+		if(fork() == 0)
+			bench_client(nrounds, samples, samples + nrounds);
+		int status;
+		wait(&status);
+		if(!WIFEXITED(status) || WEXITSTATUS(status)) {
+			printf("%s: client failed\n", bench_transports[t]);
+			failed++;
+			continue;
+		}
+		printf("%s, %d rounds:\n", bench_transports[t], nrounds);
+		bench_print("quota", samples, nrounds);
+		bench_print("fault", samples + nrounds, nrounds);
+	}
+	kill(mmu, SIGINT);
+	waitpid(mmu, NULL, 0);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
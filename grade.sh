@@ -6,14 +6,14 @@ TESTSPEC=mempager-tests/tests.spec
 
 make
 
-while read -r num frames blocks nodiff ; do
+while read -r num frames blocks nodiff opts ; do
     num=$((num))
     frames=$((frames))
     blocks=$((blocks))
     nodiff=$((nodiff))
     echo "running test$num"
     rm -rf mmu.sock mmu.pmem.img.*
-    ./bin/mmu $frames $blocks &> test$num.mmu.out &
+    ./bin/mmu $opts $frames $blocks &> test$num.mmu.out &
     sleep 1s
     ./bin/test$num &> test$num.out
     kill -SIGINT %1
@@ -22,7 +22,7 @@ while read -r num frames blocks nodiff ; do
     if [ $nodiff -eq 1 ] ; then
         continue
     fi
-    if ! diff mempager-tests/test$num.mmu.out test$num.mmu.out > /dev/null ; then
+    if [ $nodiff -eq 0 ] && ! diff mempager-tests/test$num.mmu.out test$num.mmu.out > /dev/null ; then
         echo "test$num.mmu.out differs"
     fi
     if ! diff mempager-tests/test$num.out test$num.out > /dev/null ; then
@@ -0,0 +1,45 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+int main(void) {
+	size_t PAGESIZE = sysconf(_SC_PAGESIZE);
+	uvm_create();
+
+	/* three pages in one request, laid out back to back */
+	char *range = uvm_extend_n(3);
+	assert(range == (char *)UVM_BASEADDR);
+	for(int i = 0; i < 3; ++i) {
+		sprintf(range + i*PAGESIZE, "range%d", i);
+	}
+
+	/* five blocks are left: a six-page range must fail as a whole */
+	char *big = uvm_extend_n(6);
+	assert(big == NULL);
+	assert(errno == ENOSPC);
+	assert(uvm_extend_n(0) == NULL);
+	assert(errno == EINVAL);
+
+	/* so the next page follows the first range */
+	char *page = uvm_extend();
+	assert(page == range + 3*PAGESIZE);
+	strcpy(page, "single");
+
+	char *rest = uvm_extend_n(4);
+	assert(rest == page + PAGESIZE);
+	strcpy(rest + 3*PAGESIZE, "last");
+	assert(uvm_extend() == NULL);
+
+	for(int i = 0; i < 3; ++i) {
+		uvm_syslog(range + i*PAGESIZE, 6);
+	}
+	uvm_syslog(page, 6);
+	uvm_syslog(rest + 3*PAGESIZE, 4);
+	exit(EXIT_SUCCESS);
+}
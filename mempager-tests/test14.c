@@ -0,0 +1,40 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+int num_pages = 8; /* test with mmu 4 8 */
+int main(void) {
+	uvm_create();
+	char **pages = malloc(num_pages * sizeof(pages[0]));
+	for(int i = 0; i < num_pages; ++i) {
+		pages[i] = uvm_extend();
+		sprintf(pages[i], "page%d", i);
+	}
+	/* every block is in use */
+	assert(uvm_extend() == NULL);
+
+	assert(uvm_release(pages[2] + 1, 1) == -1);
+	assert(errno == EINVAL);
+	assert(uvm_release(pages[6], 3) == -1);
+	assert(errno == EINVAL);
+
+	/* pages 2 and 3 are on disk, 4 and 5 in memory */
+	assert(uvm_release(pages[2], 4) == 0);
+	/* released pages keep their blocks */
+	assert(uvm_extend() == NULL);
+
+	/* released pages read as zeroes and can be reused */
+	uvm_syslog(pages[2], 5);
+	uvm_syslog(pages[4], 5);
+	strcpy(pages[3], "again");
+	for(int i = 0; i < num_pages; ++i) {
+		uvm_syslog(pages[i], 5);
+	}
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,59 @@
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+int num_forks = 6;
+int num_pages = 8;
+int num_loops = 24; /* run with ./mmu -o loadctl=5 12 128 */
+size_t PAGESIZE = 0;
+
+/* Together the clients' pages are four times the frames, so load
+ * control suspends and resumes them while they write; every byte a
+ * client wrote must read back.  Returns the number of mismatches. */
+int client(void) {
+	pid_t pid = getpid();
+	uvm_create();
+	char **pages = malloc(num_pages * sizeof(pages[0]));
+	for(int i = 0; i < num_pages; ++i) {
+		pages[i] = uvm_extend();
+		if(!pages[i]) return 1;
+	}
+	char want[32];
+	for(int i = 0; i < num_loops; ++i) {
+		for(int j = 0; j < num_pages; ++j) {
+			sprintf(want, "%d:%d:%d", (int)pid, j, i);
+			strcpy(pages[j] + i*64, want);
+		}
+	}
+	int bad = 0;
+	for(int i = 0; i < num_loops; ++i) {
+		for(int j = 0; j < num_pages; ++j) {
+			sprintf(want, "%d:%d:%d", (int)pid, j, i);
+			if(strcmp(pages[j] + i*64, want)) bad++;
+		}
+	}
+	return bad;
+}
+
+int main(void) {
+	PAGESIZE = sysconf(_SC_PAGESIZE);
+	fflush(stdout);
+	for(int i = 0; i < num_forks; ++i) {
+		if(fork() == 0) exit(client() ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+	int failed = 0;
+	for(int i = 0; i < num_forks; ++i) {
+		int status;
+		wait(&status);
+		if(!WIFEXITED(status) || WEXITSTATUS(status)) failed++;
+	}
+	printf("%d clients, %d failed\n", num_forks, failed);
+	exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
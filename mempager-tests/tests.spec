@@ -10,3 +10,9 @@
 10 4 8 0
 11 2 3 1
 12 256 1024 1
+13 4 8 0
+14 4 8 0
+15 16 128 2 -o rssmin=2 -o rssmax=4
+16 12 128 2 -o loadctl=5
+17 16 128 2 -o swapcluster=4 -o readahead=4
+18 8 200 2 -a 4
@@ -0,0 +1,226 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hist.h"
+#include "log.h"
+
+/*****************************************************************************
+ * bucket layout and per-thread state
+ ****************************************************************************/
+#define HIST_SUB_BITS 5
+#define HIST_MAX_EXP 40 /* samples are capped at 2^40 ns, about 18 minutes */
+#define HIST_BUCKETS ((HIST_MAX_EXP - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+struct hist {
+	uint64_t count[HIST_BUCKETS];
+	uint64_t max;
+};
+
+/* Histograms of one thread, and the parts of the fault it is servicing
+ * if =in_fault= is set.  Only the owner writes them. */
+struct hist_thread {
+	struct hist h[HIST_NUM];
+	int in_fault;
+	uint64_t fault_start;
+	uint64_t parts[HIST_NUM];
+	struct hist_thread *next;
+	struct hist_thread **pprev;
+};
+
+static const char *hist_names[HIST_NUM] = {
+	[HIST_FAULT] = "fault",
+	[HIST_FAULT_LOCK] = "fault.lock",
+	[HIST_FAULT_SELECT] = "fault.select",
+	[HIST_FAULT_DISK] = "fault.disk",
+	[HIST_FAULT_RTT] = "fault.rtt",
+	[HIST_FAULT_OTHER] = "fault.other",
+	[HIST_RESIDENT] = "resident",
+	[HIST_NONRESIDENT] = "nonresident",
+	[HIST_CHPROT] = "chprot",
+	[HIST_DISK_READ] = "disk_read",
+	[HIST_DISK_WRITE] = "disk_write",
+};
+
+static pthread_mutex_t hist_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct hist_thread *hist_threads = NULL;
+static struct hist hist_retired[HIST_NUM];
+static pthread_key_t hist_key;
+static pthread_once_t hist_once = PTHREAD_ONCE_INIT;
+static __thread struct hist_thread *hist_self_ptr = NULL;
+
+static struct hist_thread * hist_self(void);
+static void hist_key_init(void);
+static void hist_thread_exit(void *arg);
+static void hist_add(struct hist *h, uint64_t ns);
+static void hist_merge(struct hist *to, const struct hist *from);
+static int hist_index(uint64_t ns);
+static uint64_t hist_low(int index);
+static uint64_t hist_quantile(const struct hist *h, uint64_t total, double q);
+
+/*****************************************************************************
+ * public function implementations
+ ****************************************************************************/
+uint64_t hist_now(void) /* {{{ */
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+} /* }}} */
+
+void hist_record(enum hist_id id, uint64_t ns) /* {{{ */
+{
+	hist_add(&hist_self()->h[id], ns);
+} /* }}} */
+
+void hist_fault_begin(void) /* {{{ */
+{
+	struct hist_thread *t = hist_self();
+	memset(t->parts, 0, sizeof(t->parts));
+	t->in_fault = 1;
+	t->fault_start = hist_now();
+} /* }}} */
+
+void hist_fault_add(enum hist_id id, uint64_t ns) /* {{{ */
+{
+	struct hist_thread *t = hist_self_ptr;
+	if(t == NULL || !t->in_fault) return;
+	t->parts[id] += ns;
+} /* }}} */
+
+void hist_fault_end(void) /* {{{ */
+{
+	struct hist_thread *t = hist_self();
+	if(!t->in_fault) return;
+	t->in_fault = 0;
+	uint64_t total = hist_now() - t->fault_start;
+	uint64_t other = total;
+	for(int id = HIST_FAULT_LOCK; id < HIST_FAULT_OTHER; id++) {
+		hist_add(&t->h[id], t->parts[id]);
+		other = other > t->parts[id] ? other - t->parts[id] : 0;
+	}
+	hist_add(&t->h[HIST_FAULT_OTHER], other);
+	hist_add(&t->h[HIST_FAULT], total);
+} /* }}} */
+
+void hist_dump(void) /* {{{ */
+{
+	struct hist *sum = malloc(sizeof(hist_retired));
+	if(sum == NULL) return;
+	pthread_mutex_lock(&hist_lock);
+	memcpy(sum, hist_retired, sizeof(hist_retired));
+	for(struct hist_thread *t = hist_threads; t != NULL; t = t->next)
+		for(int id = 0; id < HIST_NUM; id++)
+			hist_merge(&sum[id], &t->h[id]);
+	pthread_mutex_unlock(&hist_lock);
+
+	for(int id = 0; id < HIST_NUM; id++) {
+		uint64_t total = 0;
+		for(int i = 0; i < HIST_BUCKETS; i++) total += sum[id].count[i];
+		if(total == 0) continue;
+		logd(LOG_INFO, "hist %s count %" PRIu64 " p50 %" PRIu64
+				" p99 %" PRIu64 " p999 %" PRIu64 " max %" PRIu64 " ns\n",
+				hist_names[id], total,
+				hist_quantile(&sum[id], total, 0.5),
+				hist_quantile(&sum[id], total, 0.99),
+				hist_quantile(&sum[id], total, 0.999), sum[id].max);
+	}
+	free(sum);
+} /* }}} */
+
+/*****************************************************************************
+ * static function implementations
+ ****************************************************************************/
+static struct hist_thread * hist_self(void) /* {{{ */
+{
+	if(hist_self_ptr) return hist_self_ptr;
+	pthread_once(&hist_once, hist_key_init);
+	struct hist_thread *t = calloc(1, sizeof(*t));
+	if(t == NULL) logea(__FILE__, __LINE__, NULL);
+	pthread_mutex_lock(&hist_lock);
+	t->next = hist_threads;
+	t->pprev = &hist_threads;
+	if(hist_threads) hist_threads->pprev = &t->next;
+	hist_threads = t;
+	pthread_mutex_unlock(&hist_lock);
+	pthread_setspecific(hist_key, t);
+	hist_self_ptr = t;
+	return t;
+} /* }}} */
+
+static void hist_key_init(void) /* {{{ */
+{
+	pthread_key_create(&hist_key, hist_thread_exit);
+} /* }}} */
+
+/* Folds the histograms of an exiting thread into =hist_retired=. */
+static void hist_thread_exit(void *arg) /* {{{ */
+{
+	struct hist_thread *t = arg;
+	pthread_mutex_lock(&hist_lock);
+	for(int id = 0; id < HIST_NUM; id++)
+		hist_merge(&hist_retired[id], &t->h[id]);
+	*t->pprev = t->next;
+	if(t->next) t->next->pprev = t->pprev;
+	pthread_mutex_unlock(&hist_lock);
+	hist_self_ptr = NULL;
+	free(t);
+} /* }}} */
+
+/* Only the owning thread adds samples, while =hist_dump= may read them;
+ * relaxed loads and stores keep both sides free of data races without
+ * an atomic read-modify-write. */
+static void hist_add(struct hist *h, uint64_t ns) /* {{{ */
+{
+	uint64_t *c = &h->count[hist_index(ns)];
+	__atomic_store_n(c, __atomic_load_n(c, __ATOMIC_RELAXED) + 1,
+			__ATOMIC_RELAXED);
+	if(ns > __atomic_load_n(&h->max, __ATOMIC_RELAXED))
+		__atomic_store_n(&h->max, ns, __ATOMIC_RELAXED);
+} /* }}} */
+
+static void hist_merge(struct hist *to, const struct hist *from) /* {{{ */
+{
+	for(int i = 0; i < HIST_BUCKETS; i++)
+		to->count[i] += __atomic_load_n(&from->count[i], __ATOMIC_RELAXED);
+	uint64_t max = __atomic_load_n(&from->max, __ATOMIC_RELAXED);
+	if(max > to->max) to->max = max;
+} /* }}} */
+
+/* Values below 2*HIST_SUB_BUCKETS get a bucket each; above, the bucket is
+ * given by the position of the highest set bit and the HIST_SUB_BITS bits
+ * after it. */
+static int hist_index(uint64_t ns) /* {{{ */
+{
+	if(ns < 2 * HIST_SUB_BUCKETS) return (int)ns;
+	if(ns >= (uint64_t)1 << HIST_MAX_EXP) ns = ((uint64_t)1 << HIST_MAX_EXP) - 1;
+	int e = 63 - __builtin_clzll(ns);
+	return (e - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS
+		+ (int)(ns >> (e - HIST_SUB_BITS)) - HIST_SUB_BUCKETS;
+} /* }}} */
+
+/* Returns the lowest value in bucket =index=. */
+static uint64_t hist_low(int index) /* {{{ */
+{
+	if(index < 2 * HIST_SUB_BUCKETS) return index;
+	int e = index / HIST_SUB_BUCKETS + HIST_SUB_BITS - 1;
+	uint64_t sub = HIST_SUB_BUCKETS + index % HIST_SUB_BUCKETS;
+	return sub << (e - HIST_SUB_BITS);
+} /* }}} */
+
+/* Returns the highest value of the bucket holding quantile =q=, but no
+ * more than the largest sample. */
+static uint64_t hist_quantile(const struct hist *h, uint64_t total, double q) /* {{{ */
+{
+	uint64_t rank = (uint64_t)(q * total + 0.999999);
+	if(rank == 0) rank = 1;
+	uint64_t seen = 0;
+	for(int i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->count[i];
+		if(seen < rank) continue;
+		uint64_t high = i + 1 < HIST_BUCKETS ? hist_low(i + 1) - 1 : h->max;
+		return high < h->max ? high : h->max;
+	}
+	return h->max;
+} /* }}} */
@@ -0,0 +1,56 @@
+/* This module keeps latency histograms of the MMU's operations.  Buckets
+ * are log-linear, as in HDR histograms: each power of two is split into
+ * HIST_SUB_BUCKETS linear buckets, so quantiles are exact below
+ * 2*HIST_SUB_BUCKETS nanoseconds and within about 3% above.  Every thread
+ * records into histograms of its own, without locks or atomic
+ * read-modify-writes; =hist_dump= merges them.  The histograms of threads
+ * that exit are folded into a shared set first.
+ *
+ * The time a fault takes to service is also split in parts: the thread
+ * brackets it with =hist_fault_begin= and =hist_fault_end=, and the code
+ * in between charges the time it waits on locks, selects victims, copies
+ * to and from disk, or waits on the client with =hist_fault_add=.  The
+ * remainder is recorded as HIST_FAULT_OTHER. */
+
+#ifndef __HIST_HEADER__
+#define __HIST_HEADER__
+
+#include <stdint.h>
+
+#define HIST_SUB_BUCKETS 32
+
+enum hist_id {
+	HIST_FAULT,
+	HIST_FAULT_LOCK,
+	HIST_FAULT_SELECT,
+	HIST_FAULT_DISK,
+	HIST_FAULT_RTT,
+	HIST_FAULT_OTHER,
+	HIST_RESIDENT,
+	HIST_NONRESIDENT,
+	HIST_CHPROT,
+	HIST_DISK_READ,
+	HIST_DISK_WRITE,
+	HIST_NUM
+};
+
+/* This function returns a monotonic timestamp in nanoseconds. */
+uint64_t hist_now(void);
+
+/* This function records a sample of =ns= nanoseconds in histogram =id=. */
+void hist_record(enum hist_id id, uint64_t ns);
+
+/* These functions bracket the service of a fault by the calling thread.
+ * =hist_fault_add= charges =ns= nanoseconds to part =id= (one of
+ * HIST_FAULT_LOCK to HIST_FAULT_RTT) of the fault being serviced; it does
+ * nothing outside a fault, e.g., in background threads.  =hist_fault_end=
+ * records the total and each part. */
+void hist_fault_begin(void);
+void hist_fault_add(enum hist_id id, uint64_t ns);
+void hist_fault_end(void);
+
+/* This function logs the number of samples and the 50th, 99th and 99.9th
+ * percentiles and maximum of every nonempty histogram. */
+void hist_dump(void);
+
+#endif
@@ -0,0 +1,154 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+/*****************************************************************************
+ * format constants and helpers
+ ****************************************************************************/
+#define LZ_MINMATCH 4
+#define LZ_MAXOFFSET 65535
+#define LZ_HASH_BITS 12
+#define LZ_RUNMASK 15
+
+static uint32_t lz_read32(const uint8_t *p);
+static uint32_t lz_hash(uint32_t v);
+static uint8_t * lz_putlen(uint8_t *op, size_t len);
+static uint8_t * lz_sequence(uint8_t *op, const uint8_t *oend,
+		const uint8_t *lit, size_t nlit, size_t offset, size_t mlen);
+static int lz_getlen(const uint8_t **ip, const uint8_t *iend, size_t *len);
+
+/*****************************************************************************
+ * public function implementations
+ ****************************************************************************/
+size_t lz_compress(const void *src, size_t n, void *dst, size_t cap) /* {{{ */
+{
+	const uint8_t *in = src;
+	const uint8_t *iend = in + n;
+	const uint8_t *ip = in;
+	const uint8_t *anchor = in;
+	uint8_t *op = dst;
+	const uint8_t *oend = op + cap;
+	int32_t table[1 << LZ_HASH_BITS];
+
+	memset(table, 0xff, sizeof(table));
+	while(n >= LZ_MINMATCH && ip <= iend - LZ_MINMATCH) {
+		uint32_t seq = lz_read32(ip);
+		uint32_t h = lz_hash(seq);
+		int32_t ref = table[h];
+		table[h] = (int32_t)(ip - in);
+		if(ref < 0 || ip - (in + ref) > LZ_MAXOFFSET ||
+				lz_read32(in + ref) != seq) {
+			ip++;
+			continue;
+		}
+		const uint8_t *match = in + ref;
+		size_t mlen = LZ_MINMATCH;
+		while(ip + mlen < iend && match[mlen] == ip[mlen]) mlen++;
+		op = lz_sequence(op, oend, anchor, ip - anchor, ip - match, mlen);
+		if(!op) return 0;
+		ip += mlen;
+		anchor = ip;
+	}
+	op = lz_sequence(op, oend, anchor, iend - anchor, 0, 0);
+	if(!op) return 0;
+	return op - (uint8_t *)dst;
+} /* }}} */
+
+long lz_decompress(const void *src, size_t n, void *dst, size_t cap) /* {{{ */
+{
+	const uint8_t *ip = src;
+	const uint8_t *iend = ip + n;
+	uint8_t *op = dst;
+	uint8_t *ostart = dst;
+	const uint8_t *oend = op + cap;
+
+	while(ip < iend) {
+		unsigned token = *ip++;
+		size_t nlit = token >> 4;
+		if(nlit == LZ_RUNMASK && lz_getlen(&ip, iend, &nlit)) return -1;
+		if(nlit > (size_t)(iend - ip) || nlit > (size_t)(oend - op))
+			return -1;
+		memcpy(op, ip, nlit);
+		op += nlit;
+		ip += nlit;
+		if(ip == iend) break;
+
+		if(iend - ip < 2) return -1;
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		size_t mlen = token & LZ_RUNMASK;
+		if(mlen == LZ_RUNMASK && lz_getlen(&ip, iend, &mlen)) return -1;
+		mlen += LZ_MINMATCH;
+		if(offset == 0 || offset > (size_t)(op - ostart) ||
+				mlen > (size_t)(oend - op))
+			return -1;
+		/* matches may overlap the output, copy byte by byte */
+		const uint8_t *match = op - offset;
+		while(mlen--) *op++ = *match++;
+	}
+	return op - ostart;
+} /* }}} */
+
+/*****************************************************************************
+ * static function implementations
+ ****************************************************************************/
+static uint32_t lz_read32(const uint8_t *p) /* {{{ */
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+} /* }}} */
+
+static uint32_t lz_hash(uint32_t v) /* {{{ */
+{
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+} /* }}} */
+
+static uint8_t * lz_putlen(uint8_t *op, size_t len) /* {{{ */
+{
+	while(len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (uint8_t)len;
+	return op;
+} /* }}} */
+
+/* Emits =nlit= literals followed by a match of =mlen= bytes at =offset=,
+ * or only the literals if =mlen= is zero.  Returns NULL if the sequence
+ * does not fit before =oend=. */
+static uint8_t * lz_sequence(uint8_t *op, const uint8_t *oend, /* {{{ */
+		const uint8_t *lit, size_t nlit, size_t offset, size_t mlen)
+{
+	size_t mrun = mlen ? mlen - LZ_MINMATCH : 0;
+	size_t need = 1 + nlit + (nlit >= LZ_RUNMASK ? nlit/255 + 1 : 0);
+	if(mlen) need += 2 + (mrun >= LZ_RUNMASK ? mrun/255 + 1 : 0);
+	if(need > (size_t)(oend - op)) return NULL;
+
+	uint8_t *token = op++;
+	*token = (nlit >= LZ_RUNMASK ? LZ_RUNMASK : nlit) << 4;
+	if(nlit >= LZ_RUNMASK) op = lz_putlen(op, nlit - LZ_RUNMASK);
+	memcpy(op, lit, nlit);
+	op += nlit;
+	if(mlen) {
+		*op++ = offset & 0xff;
+		*op++ = offset >> 8;
+		*token |= mrun >= LZ_RUNMASK ? LZ_RUNMASK : mrun;
+		if(mrun >= LZ_RUNMASK) op = lz_putlen(op, mrun - LZ_RUNMASK);
+	}
+	return op;
+} /* }}} */
+
+/* Adds the extension bytes of a run length at =*ip= to =*len=.  Returns
+ * nonzero if the input ends before the run length does. */
+static int lz_getlen(const uint8_t **ip, const uint8_t *iend, size_t *len) /* {{{ */
+{
+	unsigned b;
+	do {
+		if(*ip >= iend) return 1;
+		b = *(*ip)++;
+		*len += b;
+	} while(b == 255);
+	return 0;
+} /* }}} */
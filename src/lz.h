@@ -0,0 +1,24 @@
+/* This module implements a small LZ77 codec for page-sized buffers.  It
+ * trades compression ratio for speed: matches are found through a single
+ * hash table lookup and there is no entropy coding.  The stream is a
+ * sequence of tokens, each holding a run of literals followed by a match
+ * (a 16-bit offset back into the output and a length); the last token
+ * holds only literals.  The format is similar to LZ4 blocks. */
+
+#ifndef __LZ_HEADER__
+#define __LZ_HEADER__
+
+#include <stddef.h>
+
+/* This function compresses the =n= bytes at =src= into =dst=, which has
+ * room for =cap= bytes.  It returns the compressed size, or zero if the
+ * output would not fit in =cap= bytes.  Callers can pass a =cap= smaller
+ * than =n= to give up early on data that does not compress well. */
+size_t lz_compress(const void *src, size_t n, void *dst, size_t cap);
+
+/* This function decompresses the =n= bytes at =src= into =dst=, which has
+ * room for =cap= bytes.  It returns the decompressed size, or -1 if the
+ * input is malformed or does not fit in =cap= bytes. */
+long lz_decompress(const void *src, size_t n, void *dst, size_t cap);
+
+#endif
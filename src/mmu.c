@@ -1,4 +1,7 @@
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -7,6 +10,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdlib.h>
@@ -14,17 +18,21 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "hist.h"
 #include "log.h"
+#include "lz.h"
 
+#include "mmu.h"
 #include "pager.h"
+#include "policy.h"
 #include "mmuproto.h"
+#include "ring.h"
 
-#define MMU_MAX_EVENTS 32
-#define MMU_MAX_SOCK 1024
-
-
-pid_t id2pid[UINT8_MAX];
-uint8_t nextid = 0;
+#define MMU_MAX_FRAMES 65536
+#define MMU_DEFAULT_WORKERS 8
+#define MMU_MAX_WORKERS 256
+#define MMU_MAX_WINDOW 4096
+#define MMU_INIT_CLIENTS 64
 
 /****************************************************************************
  * structure definitions and static variables
@@ -37,13 +45,105 @@ struct mmu_data {/*{{{*/
 	char *pmem_fn;
 	int pmem_fd;
 	int sock;
-	struct mmu_client * sock2client[MMU_MAX_SOCK];
+	int window;
+	struct mmu_zswap *zswap;
+	/* client tables (see mmu_client_search); grown as needed */
+	pthread_rwlock_t clients_lock;
+	struct mmu_client **sock2client;
+	int nsocks;
+	struct mmu_client **pid2client;
+	int npid2client;
+	int nclients;
+	int *free_ids;
+	int nfree_ids;
+	int nids;
+	int maxids;
+	int epfd;
+	int wakefd;
+	pthread_mutex_t ready_lock;
+	struct mmu_client *ready_head;
+	struct mmu_client *ready_tail;
+	struct mmu_client *free_clients;
+};/*}}}*/
+/* Compressed page pool (see mmu_zswap_store).  The arena is split in
+ * MMU_ZSWAP_CHUNK-byte chunks and each stored page takes a run of
+ * contiguous chunks, found next-fit from `cursor`.  A handle indexes
+ * the first chunk and compressed length of a stored page. */
+#define MMU_ZSWAP_CHUNK 64
+struct mmu_zswap {/*{{{*/
+	pthread_mutex_t lock;
+	char *arena;
+	uint8_t *used;
+	int nchunks;
+	int cursor;
+	int *first;
+	int *len;
+	int *free_handles;
+	int nfree;
+};/*}}}*/
+/* Any request a client may send. */
+union mmu_client_msg {/*{{{*/
+	uint32_t type;
+	struct mmu_proto_create_req create;
+	struct mmu_proto_extend_req extend;
+	struct mmu_proto_extend_n_req extend_n;
+	struct mmu_proto_release_req release;
+	struct mmu_proto_syslog_req syslog;
+	struct mmu_proto_segv_req segv;
+	struct mmu_proto_quota_req quota;
+	struct mmu_proto_ring_req ring;
+	struct mmu_proto_exit_req exit;
+};/*}}}*/
+/* A request stashed while reading acknowledgements. */
+struct mmu_client_req {/*{{{*/
+	struct mmu_client_req *next;
+	size_t size;
+	union mmu_client_msg msg;
 };/*}}}*/
+/* Clients are served by a fixed pool of workers (see mmu_worker).  A
+ * client is owned by at most one worker at a time, which reads its
+ * requests into `msg` and serves them; while no worker owns it, the
+ * client is armed in epoll (EPOLLONESHOT) for its next request.  MMU
+ * functions serving faults of other clients read this client's
+ * acknowledgements from the same socket: `lock` serializes reads, and
+ * requests found ahead of an acknowledgement are stashed, in order, in
+ * the `pending` list and the client is queued for a worker.  A client
+ * with several threads may have several requests in flight.
+ * Protection changes are numbered; `sent` is the last one sent and
+ * `acked` the last one the client applied.
+ *
+ * A request the pager defers (see `pager_fault`) goes back to the head
+ * of `pending` and the client is `parked`: no worker serves it and it
+ * is not armed until `mmu_resume` queues it again.  `resumed` records
+ * a resume that came before the client was parked.
+ *
+ * Clients on the shared-memory transport (see ring.h) have their rings
+ * mapped at `ring`; the request ring is read with `lock` held, and
+ * `send_lock` serializes writers of the reply ring.  `ringfd` holds the
+ * memfd of a RING request until it is served.
+ *
+ * Stale epoll events may still point at a client after it is torn
+ * down, so clients are recycled through a free list, never freed. */
 struct mmu_client {/*{{{*/
 	int running;
 	int sock;
 	pid_t pid;
-	pthread_t thread;
+	int id;
+	struct mmu_client *next_pid;
+	pthread_mutex_t lock;
+	int owned;
+	int parked;
+	int resumed;
+	uint32_t sent;
+	uint32_t acked;
+	struct ring_shm *ring;
+	int ringfd;
+	pthread_mutex_t send_lock;
+	size_t nmsg;
+	union mmu_client_msg msg;
+	struct mmu_client_req *pending;
+	struct mmu_client_req **pending_tail;
+	struct mmu_client *next;
 };/*}}}*/
 static struct mmu_data *mmu = NULL;
 const char *pmem = NULL;
@@ -56,24 +156,28 @@ static void mmu_destroy(void);
 static void mmu_client_destroy(struct mmu_client *c);
 static void mmu_shutdown_action(int signum, siginfo_t *si, void *context);
 static void mmu_accept_loop(void);
-static void * mmu_client_thread(void *vclient);
+static void * mmu_worker(void *arg);
+static void * mmu_hist_thread(void *arg);
+static void mmu_hist_rtt(enum hist_id id, uint64_t start);
+static void mmu_hist_disk(enum hist_id id, uint64_t start);
 
-int get_pid_id(pid_t pid) {
-	int i = 0;
-	for(; id2pid[i] != pid; i++);
-	return i;
-}
+static void mmu_client_add(struct mmu_client *c);
+static void mmu_client_hash(struct mmu_client *c, pid_t pid);
+static void mmu_client_unhash(struct mmu_client *c);
+static void mmu_client_remove(struct mmu_client *c);
 
 /****************************************************************************
  * initialization functions {{{
  ***************************************************************************/
-static void mmu_init(int npages, int nblocks);
+static void mmu_init(int npages, int nblocks, int nworkers, int window);
 static void mmu_init_disk(int nblocks);
 static void mmu_init_pmem(int npages);
 static void mmu_init_sock(void);
 static void mmu_init_sigs(void);
+static void mmu_init_clients(void);
+static void mmu_init_workers(int nworkers);
 
-void mmu_init(int npages, int nblocks)/*{{{*/
+void mmu_init(int npages, int nblocks, int nworkers, int window)/*{{{*/
 {
 	PAGESIZE = sysconf(_SC_PAGESIZE);
 	assert(mmu == NULL);
@@ -81,12 +185,15 @@ void mmu_init(int npages, int nblocks)/*{{{*/
 	if(!mmu) logea(__FILE__, __LINE__, NULL);
 	mmu->running = 1;
 	mmu->npages = npages;
+	mmu->window = window;
+	mmu->zswap = NULL;
 
 	mmu_init_disk(nblocks);
 	mmu_init_pmem(npages);
 	mmu_init_sock();
 	mmu_init_sigs();
-	memset(mmu->sock2client, 0, MMU_MAX_SOCK*sizeof(mmu->sock2client[0]));
+	mmu_init_clients();
+	mmu_init_workers(nworkers);
 }/*}}}*/
 
 void mmu_init_disk(int nblocks)/*{{{*/
@@ -107,9 +214,14 @@ void mmu_init_pmem(int npages)/*{{{*/
 			mmu->pmem_fn);
 
 	size_t memsz = PAGESIZE * npages;
-	for(size_t i = 0; i < npages*PAGESIZE; ++i) {
-		write(mmu->pmem_fd, "z", 1);
+	char *fill = malloc(PAGESIZE);
+	if(!fill) logea(__FILE__, __LINE__, NULL);
+	memset(fill, 'z', PAGESIZE);
+	for(int i = 0; i < npages; ++i) {
+		if(write(mmu->pmem_fd, fill, PAGESIZE) != PAGESIZE)
+			logea(__FILE__, __LINE__, NULL);
 	}
+	free(fill);
 
 	int prot = PROT_READ | PROT_WRITE;
 	mmu->pmem = mmap(NULL, memsz, prot, MAP_SHARED, mmu->pmem_fd, 0);
@@ -129,10 +241,16 @@ void mmu_init_sock(void)/*{{{*/
 	strcat(addr.sun_path, MMU_PROTO_UNIX_PATH);
 	if(bind(mmu->sock, (struct sockaddr *)&addr, sizeof(addr)) == -1)
 		logea(__FILE__, __LINE__, NULL);
-	if(listen(mmu->sock, 32) == -1)
+	if(listen(mmu->sock, SOMAXCONN) == -1)
 		logea(__FILE__, __LINE__, NULL);
 	logd(LOG_INFO, "%s: unix socket %d at %s\n", __func__, mmu->sock,
 			MMU_PROTO_UNIX_PATH);
+	/* every client takes a descriptor */
+	struct rlimit lim;
+	if(getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+		lim.rlim_cur = lim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &lim);
+	}
 }/*}}}*/
 
 void mmu_init_sigs(void)/*{{{*/
@@ -143,6 +261,69 @@ void mmu_init_sigs(void)/*{{{*/
 	new.sa_sigaction = mmu_shutdown_action;
 	sigaction(SIGINT, &new, NULL);
 	logd(LOG_INFO, "%s: SIGINT triggers shutdown\n", __func__);
+	/* SIGUSR1 is blocked in every thread (they inherit the mask) and
+	 * waited for by a thread of its own, which may take locks */
+	sigset_t usr1;
+	sigemptyset(&usr1);
+	sigaddset(&usr1, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &usr1, NULL);
+	pthread_t thread;
+	pthread_create(&thread, NULL, mmu_hist_thread, NULL);
+	pthread_detach(thread);
+	logd(LOG_INFO, "%s: SIGUSR1 dumps latency histograms\n", __func__);
+	/* clients may die while we reply (e.g., killed by the pager when
+	 * memory runs out); send then fails and the client is destroyed */
+	signal(SIGPIPE, SIG_IGN);
+}
+/*}}}*/
+
+void mmu_init_clients(void)/*{{{*/
+{
+	pthread_rwlock_init(&mmu->clients_lock, NULL);
+	mmu->nsocks = MMU_INIT_CLIENTS;
+	mmu->sock2client = calloc(mmu->nsocks, sizeof(mmu->sock2client[0]));
+	mmu->npid2client = MMU_INIT_CLIENTS;
+	mmu->pid2client = calloc(mmu->npid2client, sizeof(mmu->pid2client[0]));
+	mmu->nclients = 0;
+	mmu->maxids = MMU_INIT_CLIENTS;
+	mmu->free_ids = malloc(mmu->maxids * sizeof(mmu->free_ids[0]));
+	mmu->nfree_ids = 0;
+	mmu->nids = 0;
+	if(!mmu->sock2client || !mmu->pid2client || !mmu->free_ids)
+		logea(__FILE__, __LINE__, NULL);
+}
+/*}}}*/
+
+void mmu_init_workers(int nworkers)/*{{{*/
+{
+	mmu->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(mmu->epfd == -1) logea(__FILE__, __LINE__, NULL);
+	/* the wake eventfd counts clients in the ready queue */
+	mmu->wakefd = eventfd(0, EFD_NONBLOCK | EFD_SEMAPHORE);
+	if(mmu->wakefd == -1) logea(__FILE__, __LINE__, NULL);
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if(epoll_ctl(mmu->epfd, EPOLL_CTL_ADD, mmu->wakefd, &ev) == -1)
+		logea(__FILE__, __LINE__, NULL);
+	pthread_mutex_init(&mmu->ready_lock, NULL);
+	mmu->ready_head = NULL;
+	mmu->ready_tail = NULL;
+	mmu->free_clients = NULL;
+
+	/* SIGINT must interrupt accept() in the main thread */
+	sigset_t intr, old;
+	sigemptyset(&intr);
+	sigaddset(&intr, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &intr, &old);
+	for(int i = 0; i < nworkers; i++) {
+		pthread_t thread;
+		if(pthread_create(&thread, NULL, mmu_worker, NULL))
+			logea(__FILE__, __LINE__, NULL);
+		pthread_detach(thread);
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	logd(LOG_INFO, "%s: %d workers\n", __func__, nworkers);
 }
 /*}}}*/
 /*}}}*/
@@ -156,12 +337,25 @@ void mmu_destroy(void)/*{{{*/
 	assert(mmu);
 	unlink(mmu->pmem_fn);
 	free(mmu->pmem_fn);
-	for(int i = 3; i < MMU_MAX_SOCK; ++i) {
+	pthread_rwlock_rdlock(&mmu->clients_lock);
+	for(int i = 3; i < mmu->nsocks; ++i) {
 		if(!mmu->sock2client[i]) continue;
 		mmu_client_destroy(mmu->sock2client[i]);
 	}
+	pthread_rwlock_unlock(&mmu->clients_lock);
+	free(mmu->sock2client);
+	free(mmu->pid2client);
+	free(mmu->free_ids);
 	munmap(mmu->pmem, mmu->npages * PAGESIZE);
 	free(mmu->disk);
+	if(mmu->zswap) {
+		free(mmu->zswap->arena);
+		free(mmu->zswap->used);
+		free(mmu->zswap->first);
+		free(mmu->zswap->len);
+		free(mmu->zswap->free_handles);
+		free(mmu->zswap);
+	}
 	close(mmu->sock);
 	unlink(MMU_PROTO_UNIX_PATH);
 	free(mmu);
@@ -175,11 +369,41 @@ void mmu_shutdown_action(int signum, siginfo_t *si, void *context)/*{{{*/
 	mmu->running = 0;
 }
 /*}}}*/
+
+void * mmu_hist_thread(void *arg)/*{{{*/
+{
+	sigset_t usr1;
+	sigemptyset(&usr1);
+	sigaddset(&usr1, SIGUSR1);
+	while(1) {
+		int sig;
+		if(sigwait(&usr1, &sig) == 0) hist_dump();
+	}
+	return NULL;
+}
+/*}}}*/
 /*}}}*/
 
 /****************************************************************************
  * main loop and client functions {{{
  ***************************************************************************/
+static struct mmu_client * mmu_client_alloc(int sock);
+static void mmu_client_arm(struct mmu_client *c, int op);
+static void mmu_client_enqueue(struct mmu_client *c);
+static struct mmu_client * mmu_client_dequeue(void);
+static int mmu_client_next(struct mmu_client *c);
+static void mmu_client_yield(struct mmu_client *c);
+static void mmu_client_defer(struct mmu_client *c);
+static size_t mmu_client_msg_size(uint32_t type);
+static ssize_t mmu_client_recv(struct mmu_client *c, void *req, size_t size);
+static ssize_t mmu_client_read(struct mmu_client *c, void *buf, size_t len, int flags);
+static ssize_t mmu_client_read_fd(struct mmu_client *c, void *buf, size_t len);
+static int mmu_client_drain(struct mmu_client *c);
+static ssize_t mmu_client_send(struct mmu_client *c, const void *buf, size_t len);
+static int mmu_client_read_ack(struct mmu_client *c, uint32_t type);
+static int mmu_client_wait(struct mmu_client *c, uint32_t seq);
+static int mmu_client_prot(struct mmu_client *c, void *rep, size_t size);
+
 void mmu_accept_loop(void)/*{{{*/
 {
 	while(mmu->running) {
@@ -189,15 +413,9 @@ void mmu_accept_loop(void)/*{{{*/
 		int nsock = accept(mmu->sock, (struct sockaddr *)&addr, &addrlen);
 		if(nsock == -1) continue;
 		logd(LOG_DEBUG, "%s: sock %d\n", __func__, nsock);
-		logd(LOG_DEBUG, "%s: creating thread\n", __func__);
-		struct mmu_client *c = malloc(sizeof(*c));
-		if(!c) logea(__FILE__, __LINE__, NULL);
-		mmu->sock2client[nsock] = c;
-		c->running = 1;
-		c->sock = nsock;
-		c->pid = 0;
-		pthread_create(&c->thread, NULL, mmu_client_thread, c);
-		pthread_detach(c->thread);
+		struct mmu_client *c = mmu_client_alloc(nsock);
+		mmu_client_add(c);
+		mmu_client_arm(c, EPOLL_CTL_ADD);
 	}
 	logd(LOG_DEBUG, "%s: exiting\n", __func__);
 }/*}}}*/
@@ -207,53 +425,318 @@ static void mmu_client_create(struct mmu_client *c);
 static void mmu_client_extend(struct mmu_client *c);
 static void mmu_client_syslog(struct mmu_client *c);
 static void mmu_client_segv(struct mmu_client *c);
+static void mmu_client_quota(struct mmu_client *c);
+static void mmu_client_extend_n(struct mmu_client *c);
+static void mmu_client_release(struct mmu_client *c);
+static void mmu_client_ring(struct mmu_client *c);
 static void mmu_client_exit(struct mmu_client *c);
 
-void * mmu_client_thread(void *vclient)/*{{{*/
+/* Workers take one event at a time, so clients that become ready
+ * together are served by different workers rather than in turn by
+ * one.  An event with no client wakes a worker for the ready queue. */
+void * mmu_worker(void *arg)/*{{{*/
 {
-	struct mmu_client *c = vclient;
-	while(mmu->running && c->running) {
-		mmu_client_log(c, __func__, "recv");
-		uint32_t type;
-		ssize_t cnt = recv(c->sock, &type, sizeof(type), MSG_PEEK);
-		if(!mmu->running || !c->running) {
-			mmu_client_log(c, __func__, "breaking loop");
-			break;
+	while(1) {
+		struct epoll_event ev;
+		if(epoll_wait(mmu->epfd, &ev, 1, -1) != 1) continue;
+		struct mmu_client *c = ev.data.ptr;
+		if(c == NULL) {
+			uint64_t one;
+			if(read(mmu->wakefd, &one, sizeof(one)) != sizeof(one))
+				continue;
+			c = mmu_client_dequeue();
+		} else {
+			pthread_mutex_lock(&c->lock);
+			int taken = c->owned;
+			c->owned = 1;
+			pthread_mutex_unlock(&c->lock);
+			if(taken) continue;
+		}
+		while(mmu_client_next(c)) {
+			switch(c->msg.type) {
+			case MMU_PROTO_CREATE_REQ:
+				mmu_client_create(c);
+				break;
+			case MMU_PROTO_EXTEND_REQ:
+				mmu_client_extend(c);
+				break;
+			case MMU_PROTO_EXTEND_N_REQ:
+				mmu_client_extend_n(c);
+				break;
+			case MMU_PROTO_RELEASE_REQ:
+				mmu_client_release(c);
+				break;
+			case MMU_PROTO_SYSLOG_REQ:
+				mmu_client_syslog(c);
+				break;
+			case MMU_PROTO_SEGV_REQ:
+				mmu_client_segv(c);
+				break;
+			case MMU_PROTO_QUOTA_REQ:
+				mmu_client_quota(c);
+				break;
+			case MMU_PROTO_RING_REQ:
+				mmu_client_ring(c);
+				break;
+			case MMU_PROTO_EXIT_REQ:
+				mmu_client_exit(c);
+				break;
+			}
+		}
+	}
+	return NULL;
+}/*}}}*/
+
+struct mmu_client * mmu_client_alloc(int sock)/*{{{*/
+{
+	pthread_mutex_lock(&mmu->ready_lock);
+	struct mmu_client *c = mmu->free_clients;
+	if(c) mmu->free_clients = c->next;
+	pthread_mutex_unlock(&mmu->ready_lock);
+	if(!c) {
+		c = malloc(sizeof(*c));
+		if(!c) logea(__FILE__, __LINE__, NULL);
+		pthread_mutex_init(&c->lock, NULL);
+		pthread_mutex_init(&c->send_lock, NULL);
+	}
+	pthread_mutex_lock(&c->lock);
+	c->running = 1;
+	c->sock = sock;
+	c->pid = 0;
+	c->id = -1;
+	c->owned = 0;
+	c->parked = 0;
+	c->resumed = 0;
+	c->sent = 0;
+	c->acked = 0;
+	c->ring = NULL;
+	c->ringfd = -1;
+	c->nmsg = 0;
+	c->pending = NULL;
+	c->pending_tail = &c->pending;
+	pthread_mutex_unlock(&c->lock);
+	return c;
+}/*}}}*/
+
+void mmu_client_arm(struct mmu_client *c, int op)/*{{{*/
+{
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.ptr = c;
+	if(epoll_ctl(mmu->epfd, op, c->sock, &ev) == -1)
+		logea(__FILE__, __LINE__, NULL);
+}/*}}}*/
+
+/* Queues `c`, owned by the caller, for the next idle worker. */
+void mmu_client_enqueue(struct mmu_client *c)/*{{{*/
+{
+	pthread_mutex_lock(&mmu->ready_lock);
+	c->next = NULL;
+	if(mmu->ready_tail) mmu->ready_tail->next = c;
+	else mmu->ready_head = c;
+	mmu->ready_tail = c;
+	pthread_mutex_unlock(&mmu->ready_lock);
+	uint64_t one = 1;
+	if(write(mmu->wakefd, &one, sizeof(one)) != sizeof(one))
+		logea(__FILE__, __LINE__, NULL);
+}/*}}}*/
+
+struct mmu_client * mmu_client_dequeue(void)/*{{{*/
+{
+	pthread_mutex_lock(&mmu->ready_lock);
+	struct mmu_client *c = mmu->ready_head;
+	mmu->ready_head = c->next;
+	if(!mmu->ready_head) mmu->ready_tail = NULL;
+	pthread_mutex_unlock(&mmu->ready_lock);
+	return c;
+}/*}}}*/
+
+/* Reads the next request of `c`, owned by the calling worker, into
+ * `c->msg`.  Returns 0, giving `c` up, if there is none. */
+int mmu_client_next(struct mmu_client *c)/*{{{*/
+{
+	pthread_mutex_lock(&c->lock);
+	if(!c->running || c->parked) goto out_yield;
+	if(c->pending) {
+		struct mmu_client_req *r = c->pending;
+		c->pending = r->next;
+		if(!c->pending) c->pending_tail = &c->pending;
+		c->msg = r->msg;
+		c->nmsg = r->size;
+		free(r);
+		pthread_mutex_unlock(&c->lock);
+		return 1;
+	}
+	mmu_client_log(c, __func__, "recv");
+	uint32_t type;
+	ssize_t cnt;
+	do {
+		cnt = mmu_client_read(c, &type, sizeof(type), MSG_PEEK | MSG_DONTWAIT);
+		if(cnt == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			if(c->ring && mmu_client_drain(c) == -1) goto out_client;
+			goto out_yield;
 		}
 		if(cnt != sizeof(type)) goto out_client;
-		switch(type) {
-		case MMU_PROTO_CREATE_REQ:
-			mmu_client_create(c);
-			break;
-		case MMU_PROTO_EXTEND_REQ:
-			mmu_client_extend(c);
-			break;
-		case MMU_PROTO_SYSLOG_REQ:
-			mmu_client_syslog(c);
-			break;
-		case MMU_PROTO_SEGV_REQ:
-			mmu_client_segv(c);
+		if(type != MMU_PROTO_REMAP_REQ && type != MMU_PROTO_CHPROT_REQ)
 			break;
-		case MMU_PROTO_REMAP_REQ:
-		case MMU_PROTO_CHPROT_REQ:
-			/* these messages are handled by the pager thread */
-			break;
-		case MMU_PROTO_EXIT_REQ:
-			mmu_client_exit(c);
-			break;
-		default:
-			mmu_client_log(c, __func__, "invalid message type");
-			goto out_client;
-			break;
-		}
+		/* acknowledgements of pipelined protection changes */
+		if(mmu_client_read_ack(c, type) == -1) goto out_client;
+	} while(1);
+	size_t size = mmu_client_msg_size(type);
+	if(size == 0) {
+		mmu_client_log(c, __func__, "invalid message type");
+		goto out_client;
 	}
-	mmu_client_log(c, __func__, "finished");
-	free(c);
-	pthread_exit(NULL);
+	if(type == MMU_PROTO_RING_REQ && !c->ring)
+		cnt = mmu_client_read_fd(c, &c->msg, size);
+	else
+		cnt = mmu_client_read(c, &c->msg, size, MSG_WAITALL);
+	if(cnt != (ssize_t)size)
+		goto out_client;
+	c->nmsg = size;
+	pthread_mutex_unlock(&c->lock);
+	return 1;
 
 	out_client:
 	mmu_client_destroy(c);
-	pthread_exit(NULL);
+	out_yield:
+	mmu_client_yield(c);
+	return 0;
+}/*}}}*/
+
+/* Gives up the caller's ownership of `c`, whose lock it holds: leaves
+ * `c` alone if it is parked, queues it again if it has a stashed
+ * request, tears it down if it is no longer running, and otherwise
+ * arms it for its next request.  A client on rings is armed for the
+ * doorbell, unless a request slipped into its ring before it was
+ * asked for. */
+void mmu_client_yield(struct mmu_client *c)/*{{{*/
+{
+	if(c->running) {
+		if(c->parked) {
+			c->owned = 0;
+		} else if(c->pending || (c->ring && ring_doorbell(&c->ring->req))) {
+			mmu_client_enqueue(c);
+		} else {
+			c->owned = 0;
+			mmu_client_arm(c, EPOLL_CTL_MOD);
+		}
+		pthread_mutex_unlock(&c->lock);
+		return;
+	}
+	pthread_mutex_unlock(&c->lock);
+	mmu_client_log(c, __func__, "finished");
+	if(c->pid) { /* may get here before CREATE_REQ happens */
+		pager_destroy(c->pid);
+		mmu_client_unhash(c);
+	}
+	mmu_client_remove(c);
+	close(c->sock);
+	if(c->ring) munmap(c->ring, sizeof(*c->ring));
+	if(c->ringfd != -1) close(c->ringfd);
+	while(c->pending) {
+		struct mmu_client_req *r = c->pending;
+		c->pending = r->next;
+		free(r);
+	}
+	pthread_mutex_lock(&mmu->ready_lock);
+	c->next = mmu->free_clients;
+	mmu->free_clients = c;
+	pthread_mutex_unlock(&mmu->ready_lock);
+}/*}}}*/
+
+/* Puts the request being served back at the head of the stashed ones
+ * and parks `c` until the pager resumes it (see mmu_resume), unless
+ * it already has.  Requests of a parked client stay unread, so a
+ * parked client does not take up a worker. */
+void mmu_client_defer(struct mmu_client *c)/*{{{*/
+{
+	struct mmu_client_req *r = malloc(sizeof(*r));
+	if(!r) logea(__FILE__, __LINE__, NULL);
+	r->msg = c->msg;
+	r->size = c->nmsg;
+	pthread_mutex_lock(&c->lock);
+	r->next = c->pending;
+	if(!c->pending) c->pending_tail = &r->next;
+	c->pending = r;
+	int parked = !c->resumed;
+	c->parked = parked;
+	c->resumed = 0;
+	pthread_mutex_unlock(&c->lock);
+	mmu_client_log(c, __func__, parked ? "parked" : "resumed");
+}/*}}}*/
+
+size_t mmu_client_msg_size(uint32_t type)/*{{{*/
+{
+	switch(type) {
+	case MMU_PROTO_CREATE_REQ: return sizeof(struct mmu_proto_create_req);
+	case MMU_PROTO_EXTEND_REQ: return sizeof(struct mmu_proto_extend_req);
+	case MMU_PROTO_EXTEND_N_REQ: return sizeof(struct mmu_proto_extend_n_req);
+	case MMU_PROTO_RELEASE_REQ: return sizeof(struct mmu_proto_release_req);
+	case MMU_PROTO_SYSLOG_REQ: return sizeof(struct mmu_proto_syslog_req);
+	case MMU_PROTO_SEGV_REQ: return sizeof(struct mmu_proto_segv_req);
+	case MMU_PROTO_QUOTA_REQ: return sizeof(struct mmu_proto_quota_req);
+	case MMU_PROTO_RING_REQ: return sizeof(struct mmu_proto_ring_req);
+	case MMU_PROTO_EXIT_REQ: return sizeof(struct mmu_proto_exit_req);
+	default: return 0;
+	}
+}/*}}}*/
+
+/* Copies the request being served to `req`.  Returns its size, or -1
+ * if it is not `size` bytes long. */
+ssize_t mmu_client_recv(struct mmu_client *c, void *req, size_t size)/*{{{*/
+{
+	if(c->nmsg != size) return -1;
+	memcpy(req, &c->msg, size);
+	return (ssize_t)size;
+}/*}}}*/
+
+/* Reads from the request ring of `c`, or from its socket, as recv(2)
+ * does.  The caller holds the lock of `c`. */
+ssize_t mmu_client_read(struct mmu_client *c, void *buf, size_t len, int flags)/*{{{*/
+{
+	if(c->ring) return ring_read(&c->ring->req, buf, len, flags, c->sock);
+	return recv(c->sock, buf, len, flags);
+}/*}}}*/
+
+/* Reads a RING request and the memfd that comes with it, which is kept
+ * in `c->ringfd`. */
+ssize_t mmu_client_read_fd(struct mmu_client *c, void *buf, size_t len)/*{{{*/
+{
+	struct iovec iov = { buf, len };
+	char cbuf[CMSG_SPACE(sizeof(int))];
+	struct msghdr mh = { .msg_iov = &iov, .msg_iovlen = 1,
+			.msg_control = cbuf, .msg_controllen = sizeof(cbuf) };
+	ssize_t cnt = recvmsg(c->sock, &mh, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+	struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+	if(cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS
+			&& cm->cmsg_len == CMSG_LEN(sizeof(int))) {
+		if(c->ringfd != -1) close(c->ringfd);
+		memcpy(&c->ringfd, CMSG_DATA(cm), sizeof(int));
+	}
+	return cnt;
+}/*}}}*/
+
+/* Discards the doorbells a client on rings rang on its socket.  Returns
+ * 0, or -1 if the client hung up. */
+int mmu_client_drain(struct mmu_client *c)/*{{{*/
+{
+	char bells[64];
+	ssize_t cnt;
+	while((cnt = recv(c->sock, bells, sizeof(bells), MSG_DONTWAIT)) > 0)
+		;
+	if(cnt == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+	return -1;
+}/*}}}*/
+
+/* Sends `len` bytes to `c` through its reply ring or its socket. */
+ssize_t mmu_client_send(struct mmu_client *c, const void *buf, size_t len)/*{{{*/
+{
+	if(!c->ring) return send(c->sock, buf, len, 0);
+	pthread_mutex_lock(&c->send_lock);
+	ssize_t cnt = ring_write(&c->ring->rep, buf, len, c->sock);
+	pthread_mutex_unlock(&c->send_lock);
+	return cnt;
 }/*}}}*/
 
 void mmu_client_log(const struct mmu_client *c, const char *fname, const char *msg)/*{{{*/
@@ -266,13 +749,12 @@ void mmu_client_create(struct mmu_client *c)/*{{{*/
 {
 	char msg[96];
 	struct mmu_proto_create_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
+	if(mmu_client_recv(c, &req, sizeof(req)) != sizeof(req))
 		goto out_client;
 	assert(req.type == MMU_PROTO_CREATE_REQ);
 
-	c->pid = (pid_t)req.pid;
-	int id = nextid;
-	id2pid[nextid++] = c->pid;
+	mmu_client_hash(c, (pid_t)req.pid);
+	int id = c->id;
 	printf("pager_create pid %d\n", id);
 	pager_create(c->pid);
 	snprintf(msg, 96, "create pid %d", id);
@@ -282,7 +764,7 @@ void mmu_client_create(struct mmu_client *c)/*{{{*/
 	rep.type = MMU_PROTO_CREATE_REP;
 	memset(rep.pmem_fn, '\0', MMU_PROTO_PATH_MAX);
 	strncat(rep.pmem_fn, mmu->pmem_fn, MMU_PROTO_PATH_MAX-1);
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
+	if(mmu_client_send(c, &rep, sizeof(rep)) != sizeof(rep))
 		goto out_client;
 	return;
 
@@ -294,11 +776,11 @@ void mmu_client_extend(struct mmu_client *c)/*{{{*/
 {
 	char msg[96];
 	struct mmu_proto_extend_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
+	if(mmu_client_recv(c, &req, sizeof(req)) != sizeof(req))
 		goto out_client;
 	assert(req.type == MMU_PROTO_EXTEND_REQ);
 
-	int id = get_pid_id(c->pid);
+	int id = c->id;
 	void *vaddr = pager_extend(c->pid);
 	printf("pager_extend pid %d vaddr %p\n", id, vaddr);
 	snprintf(msg, 96, "extend vaddr %p", vaddr);
@@ -307,7 +789,88 @@ void mmu_client_extend(struct mmu_client *c)/*{{{*/
 	struct mmu_proto_extend_rep rep;
 	rep.type = MMU_PROTO_EXTEND_REP;
 	rep.vaddr = (intptr_t)vaddr;
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
+	if(mmu_client_send(c, &rep, sizeof(rep)) != sizeof(rep))
+		goto out_client;
+	return;
+
+	out_client:
+	mmu_client_destroy(c);
+}/*}}}*/
+
+void mmu_client_extend_n(struct mmu_client *c)/*{{{*/
+{
+	char msg[96];
+	struct mmu_proto_extend_n_req req;
+	if(mmu_client_recv(c, &req, sizeof(req)) != sizeof(req))
+		goto out_client;
+	assert(req.type == MMU_PROTO_EXTEND_N_REQ);
+
+	int id = c->id;
+	int count = req.count > INT_MAX ? INT_MAX : (int)req.count;
+	void *vaddr = pager_extend_range(c->pid, count);
+	printf("pager_extend_range pid %d count %d vaddr %p\n", id, count,
+			vaddr);
+	snprintf(msg, 96, "extend count %d vaddr %p", count, vaddr);
+	mmu_client_log(c, __func__, msg);
+
+	struct mmu_proto_extend_n_rep rep;
+	rep.type = MMU_PROTO_EXTEND_N_REP;
+	rep.vaddr = (intptr_t)vaddr;
+	if(mmu_client_send(c, &rep, sizeof(rep)) != sizeof(rep))
+		goto out_client;
+	return;
+
+	out_client:
+	mmu_client_destroy(c);
+}/*}}}*/
+
+void mmu_client_release(struct mmu_client *c)/*{{{*/
+{
+	char msg[96];
+	struct mmu_proto_release_req req;
+	if(mmu_client_recv(c, &req, sizeof(req)) != sizeof(req))
+		goto out_client;
+	assert(req.type == MMU_PROTO_RELEASE_REQ);
+
+	int id = c->id;
+	void *addr = (void *)(intptr_t)req.addr;
+	int npages = req.npages > INT_MAX ? INT_MAX : (int)req.npages;
+	printf("pager_release pid %d %p npages %d\n", id, addr, npages);
+	int status = pager_release(c->pid, addr, npages);
+	snprintf(msg, 96, "%p npages %d retcode %d", addr, npages, status);
+	mmu_client_log(c, __func__, msg);
+
+	struct mmu_proto_release_rep rep;
+	rep.type = MMU_PROTO_RELEASE_REP;
+	rep.retcode = status;
+	if(mmu_client_send(c, &rep, sizeof(rep)) != sizeof(rep))
+		goto out_client;
+	return;
+
+	out_client:
+	mmu_client_destroy(c);
+}/*}}}*/
+
+void mmu_client_quota(struct mmu_client *c)/*{{{*/
+{
+	char msg[96];
+	struct mmu_proto_quota_req req;
+	if(mmu_client_recv(c, &req, sizeof(req)) != sizeof(req))
+		goto out_client;
+	assert(req.type == MMU_PROTO_QUOTA_REQ);
+
+	int id = c->id;
+	printf("pager_set_quota pid %d min %d max %d\n", id, (int)req.min,
+			(int)req.max);
+	int status = pager_set_quota(c->pid, req.min, req.max);
+	snprintf(msg, 96, "min %d max %d retcode %d", (int)req.min,
+			(int)req.max, status);
+	mmu_client_log(c, __func__, msg);
+
+	struct mmu_proto_quota_rep rep;
+	rep.type = MMU_PROTO_QUOTA_REP;
+	rep.retcode = status;
+	if(mmu_client_send(c, &rep, sizeof(rep)) != sizeof(rep))
 		goto out_client;
 	return;
 
@@ -319,23 +882,27 @@ void mmu_client_syslog(struct mmu_client *c)/*{{{*/
 {
 	char msg[96];
 	struct mmu_proto_syslog_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
+	if(mmu_client_recv(c, &req, sizeof(req)) != sizeof(req))
 		goto out_client;
 	assert(req.type == MMU_PROTO_SYSLOG_REQ);
 
 	assert(req.addr < UINTPTR_MAX);
 	void *vaddr = (void *)(uintptr_t)req.addr;
 	size_t len = (size_t)req.len;
-	int id = get_pid_id(c->pid);
+	int id = c->id;
 	printf("pager_syslog pid %d %p\n", id, vaddr);
 	int status = pager_syslog(c->pid, vaddr, len);
 	snprintf(msg, 96, "vaddr %p len %zu retcode %d", vaddr, len, status);
 	mmu_client_log(c, __func__, msg);
+	if(status == PAGER_DEFERRED) {
+		mmu_client_defer(c);
+		return;
+	}
 
 	struct mmu_proto_syslog_rep rep;
 	rep.type = MMU_PROTO_SYSLOG_REP;
 	rep.retcode = (uint32_t)status;
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
+	if(mmu_client_send(c, &rep, sizeof(rep)) != sizeof(rep))
 		goto out_client;
 	return;
 
@@ -347,23 +914,38 @@ void mmu_client_segv(struct mmu_client *c)/*{{{*/
 {
 	char msg[96];
 	struct mmu_proto_segv_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
+	if(mmu_client_recv(c, &req, sizeof(req)) != sizeof(req))
 		goto out_client;
 	assert(req.type == MMU_PROTO_SEGV_REQ);
 
 	assert(req.addr < UINTPTR_MAX);
 	void *vaddr = (void *)(uintptr_t)req.addr;
 	int code = (int)req.code;
-	snprintf(msg, 96, "vaddr %p code %d", vaddr, code);
+	snprintf(msg, 96, "vaddr %p code %d access %u", vaddr, code,
+			req.access);
 	mmu_client_log(c, __func__, msg);
 
-	int id = get_pid_id(c->pid);
+	int id = c->id;
 	printf("pager_fault pid %d vaddr %p\n", id, vaddr);
-	pager_fault(c->pid, vaddr);
+	hist_fault_begin();
+	int status;
+	if(req.access == MMU_PROTO_ACCESS_WRITE)
+		status = pager_fault_write(c->pid, vaddr);
+	else
+		status = pager_fault(c->pid, vaddr);
+	hist_fault_end();
+	if(status == PAGER_DEFERRED) {
+		mmu_client_defer(c);
+		return;
+	}
+	if(status == -1) {
+		mmu_client_log(c, __func__, "fault failed");
+		goto out_client;
+	}
 
 	struct mmu_proto_segv_rep rep;
 	rep.type = MMU_PROTO_SEGV_REP;
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
+	if(mmu_client_send(c, &rep, sizeof(rep)) != sizeof(rep))
 		goto out_client;
 	return;
 
@@ -371,59 +953,296 @@ void mmu_client_segv(struct mmu_client *c)/*{{{*/
 	mmu_client_destroy(c);
 }/*}}}*/
 
+/* Maps the rings in the memfd the client sent and switches `c` to
+ * them once the reply is out on the socket. */
+void mmu_client_ring(struct mmu_client *c)/*{{{*/
+{
+	struct mmu_proto_ring_req req;
+	if(mmu_client_recv(c, &req, sizeof(req)) != sizeof(req))
+		goto out_client;
+	assert(req.type == MMU_PROTO_RING_REQ);
+
+	struct ring_shm *ring = MAP_FAILED;
+	struct stat st;
+	if(c->ringfd != -1 && fstat(c->ringfd, &st) == 0
+			&& st.st_size == sizeof(*ring))
+		ring = mmap(NULL, sizeof(*ring), PROT_READ | PROT_WRITE,
+				MAP_SHARED, c->ringfd, 0);
+	if(c->ringfd != -1) close(c->ringfd);
+	c->ringfd = -1;
+	mmu_client_log(c, __func__, ring == MAP_FAILED ? "no ring" : "ring");
+
+	struct mmu_proto_ring_rep rep;
+	rep.type = MMU_PROTO_RING_REP;
+	rep.retcode = ring == MAP_FAILED ? -1 : 0;
+	if(mmu_client_send(c, &rep, sizeof(rep)) != sizeof(rep)) {
+		if(ring != MAP_FAILED) munmap(ring, sizeof(*ring));
+		goto out_client;
+	}
+	if(ring != MAP_FAILED) {
+		pthread_mutex_lock(&c->lock);
+		c->ring = ring;
+		pthread_mutex_unlock(&c->lock);
+	}
+	return;
+
+	out_client:
+	mmu_client_destroy(c);
+}/*}}}*/
+
 void mmu_client_exit(struct mmu_client *c)/*{{{*/
 {
 	struct mmu_proto_exit_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
+	if(mmu_client_recv(c, &req, sizeof(req)) != sizeof(req))
 		goto out_client;
 	mmu_client_log(c, __func__, "exiting cleanly");
 	assert(req.type == MMU_PROTO_EXIT_REQ);
 	assert(c->pid);
-	int id = get_pid_id(c->pid);
+	int id = c->id;
 	printf("pager_destroy pid %d\n", id);
 	pager_destroy(c->pid);
+	/* the pager sends no more changes once the process is destroyed,
+	 * but with a window some may still be on their way; the client
+	 * must ack them before it is told to exit */
+	pthread_mutex_lock(&c->lock);
+	uint32_t seq = c->sent;
+	pthread_mutex_unlock(&c->lock);
+	if(mmu_client_wait(c, seq) == -1) return;
+	mmu_client_unhash(c);
 
 	struct mmu_proto_segv_rep rep;
 	rep.type = MMU_PROTO_EXIT_REP;
-	send(c->sock, &rep, sizeof(rep), 0); /* ignoring return value */
+	mmu_client_send(c, &rep, sizeof(rep)); /* ignoring return value */
 
-	mmu->sock2client[c->sock] = NULL;
+	/* the worker closes the socket when it yields c */
 	c->running = 0;
-	close(c->sock);
 	return;
 
 	out_client:
 	mmu_client_destroy(c);
 }/*}}}*/
 
+/* Marks `c` gone and wakes whoever reads from it; the thread that
+ * owns `c` tears it down when it yields it (see mmu_client_yield). */
 void mmu_client_destroy(struct mmu_client *c)/*{{{*/
 {
 	loge(LOG_WARN, __FILE__, __LINE__);
 	mmu_client_log(c, __func__, "running");
-	mmu->sock2client[c->sock] = NULL;
 	c->running = 0;
-	close(c->sock);
-	if(c->pid) { /* may get here before CREATE_REQ happens */
-		pager_destroy(c->pid);
-	}
+	shutdown(c->sock, SHUT_RDWR);
 }/*}}}*/
 /*}}}*/
 
 /****************************************************************************
  * external functions {{{
  ***************************************************************************/
+/* Clients are found by socket in `sock2client` and by pid in the
+ * chained hash table `pid2client`, which is kept at no more than one
+ * client per bucket.  Ids, which name clients in the output, are
+ * recycled once their client is gone. */
+static unsigned mmu_pid_hash(pid_t pid, int nbuckets)/*{{{*/
+{
+	return ((uint32_t)pid * 2654435761u) & (nbuckets - 1);
+}/*}}}*/
+
+/* Returns the client of `pid`, or NULL if it is gone. */
+struct mmu_client * mmu_client_find(pid_t pid)/*{{{*/
+{
+	pthread_rwlock_rdlock(&mmu->clients_lock);
+	struct mmu_client *c = mmu->pid2client[mmu_pid_hash(pid, mmu->npid2client)];
+	while(c && c->pid != pid) c = c->next_pid;
+	pthread_rwlock_unlock(&mmu->clients_lock);
+	return c;
+}/*}}}*/
+
 struct mmu_client * mmu_client_search(pid_t pid)/*{{{*/
 {
-	for(int i = 3; i < MMU_MAX_SOCK; ++i) {
-		if(!mmu->sock2client[i]) continue;
-		if(mmu->sock2client[i]->pid == pid) return mmu->sock2client[i];
-	}
+	struct mmu_client *c = mmu_client_find(pid);
+	if(c) return c;
 	printf("error: pid %d not found.  aborting.\n", (int)pid);
 	logd(LOG_FATAL, "pid %d not found.  aborting.\n", (int)pid);
 	mmu_destroy();
 	exit(EXIT_FAILURE);
 }/*}}}*/
 
+void mmu_client_add(struct mmu_client *c)/*{{{*/
+{
+	pthread_rwlock_wrlock(&mmu->clients_lock);
+	if(c->sock >= mmu->nsocks) {
+		int n = mmu->nsocks;
+		while(n <= c->sock) n *= 2;
+		struct mmu_client **t = realloc(mmu->sock2client, n * sizeof(*t));
+		if(!t) logea(__FILE__, __LINE__, NULL);
+		memset(t + mmu->nsocks, 0, (n - mmu->nsocks) * sizeof(*t));
+		mmu->sock2client = t;
+		mmu->nsocks = n;
+	}
+	mmu->sock2client[c->sock] = c;
+	pthread_rwlock_unlock(&mmu->clients_lock);
+}/*}}}*/
+
+void mmu_client_remove(struct mmu_client *c)/*{{{*/
+{
+	pthread_rwlock_wrlock(&mmu->clients_lock);
+	mmu->sock2client[c->sock] = NULL;
+	if(c->id != -1) {
+		mmu->free_ids[mmu->nfree_ids++] = c->id;
+		c->id = -1;
+	}
+	pthread_rwlock_unlock(&mmu->clients_lock);
+}/*}}}*/
+
+/* Gives `c` the pid `pid` and an id, and makes it found by pid. */
+void mmu_client_hash(struct mmu_client *c, pid_t pid)/*{{{*/
+{
+	pthread_rwlock_wrlock(&mmu->clients_lock);
+	if(mmu->nfree_ids) {
+		c->id = mmu->free_ids[--mmu->nfree_ids];
+	} else {
+		if(mmu->nids == mmu->maxids) {
+			int *t = realloc(mmu->free_ids, 2 * mmu->maxids * sizeof(*t));
+			if(!t) logea(__FILE__, __LINE__, NULL);
+			mmu->free_ids = t;
+			mmu->maxids *= 2;
+		}
+		c->id = mmu->nids++;
+	}
+	if(mmu->nclients == mmu->npid2client) {
+		int n = 2 * mmu->npid2client;
+		struct mmu_client **t = calloc(n, sizeof(*t));
+		if(!t) logea(__FILE__, __LINE__, NULL);
+		for(int i = 0; i < mmu->npid2client; i++) {
+			struct mmu_client *e = mmu->pid2client[i];
+			while(e) {
+				struct mmu_client *next = e->next_pid;
+				unsigned h = mmu_pid_hash(e->pid, n);
+				e->next_pid = t[h];
+				t[h] = e;
+				e = next;
+			}
+		}
+		free(mmu->pid2client);
+		mmu->pid2client = t;
+		mmu->npid2client = n;
+	}
+	c->pid = pid;
+	unsigned h = mmu_pid_hash(pid, mmu->npid2client);
+	c->next_pid = mmu->pid2client[h];
+	mmu->pid2client[h] = c;
+	mmu->nclients++;
+	pthread_rwlock_unlock(&mmu->clients_lock);
+}/*}}}*/
+
+/* Makes `c` no longer found by pid; its id is kept until it is
+ * removed (see mmu_client_remove). */
+void mmu_client_unhash(struct mmu_client *c)/*{{{*/
+{
+	pthread_rwlock_wrlock(&mmu->clients_lock);
+	struct mmu_client **e = &mmu->pid2client[mmu_pid_hash(c->pid, mmu->npid2client)];
+	while(*e != c) e = &(*e)->next_pid;
+	*e = c->next_pid;
+	mmu->nclients--;
+	c->pid = 0;
+	pthread_rwlock_unlock(&mmu->clients_lock);
+}/*}}}*/
+
+/* Reads an acknowledgement of type `type` from `c`, whose lock the
+ * caller holds.  Returns 0, or -1 if the client is gone. */
+int mmu_client_read_ack(struct mmu_client *c, uint32_t type)/*{{{*/
+{
+	uint32_t seq;
+	if(type == MMU_PROTO_REMAP_REQ) {
+		struct mmu_proto_remap_req req;
+		if(mmu_client_read(c, &req, sizeof(req), MSG_WAITALL) != sizeof(req))
+			return -1;
+		seq = req.seq;
+	} else {
+		struct mmu_proto_chprot_req req;
+		if(mmu_client_read(c, &req, sizeof(req), MSG_WAITALL) != sizeof(req))
+			return -1;
+		seq = req.seq;
+	}
+	/* the client applies changes in order */
+	if((int32_t)(seq - c->acked) > 0) c->acked = seq;
+	return 0;
+}/*}}}*/
+
+/* Reads from `c` until it has applied protection change `seq`.  The
+ * worker that owns the client may be the one blocked here, so we read
+ * ourselves: requests that `c` sent meanwhile are stashed and handed
+ * to a worker.  Returns 0, or -1 if the client is gone. */
+int mmu_client_wait(struct mmu_client *c, uint32_t seq)/*{{{*/
+{
+	pthread_mutex_lock(&c->lock);
+	while(c->running && (int32_t)(seq - c->acked) > 0) {
+		uint32_t t;
+		if(mmu_client_read(c, &t, sizeof(t), MSG_PEEK) != sizeof(t)) break;
+		if(t == MMU_PROTO_REMAP_REQ || t == MMU_PROTO_CHPROT_REQ) {
+			if(mmu_client_read_ack(c, t) == -1) break;
+			continue;
+		}
+		size_t n = mmu_client_msg_size(t);
+		if(n == 0) break;
+		struct mmu_client_req *r = malloc(sizeof(*r));
+		if(!r) logea(__FILE__, __LINE__, NULL);
+		if(mmu_client_read(c, &r->msg, n, MSG_WAITALL) != (ssize_t)n) {
+			free(r);
+			break;
+		}
+		r->next = NULL;
+		r->size = n;
+		*c->pending_tail = r;
+		c->pending_tail = &r->next;
+		if(!c->owned) {
+			c->owned = 1;
+			mmu_client_enqueue(c);
+		}
+	}
+	int status = (int32_t)(seq - c->acked) > 0 ? -1 : 0;
+	if(status == -1 && c->running) mmu_client_destroy(c);
+	pthread_mutex_unlock(&c->lock);
+	return status;
+}/*}}}*/
+
+/* Numbers protection change `rep`, a REMAP or CHPROT reply or a
+ * vector of them `size` bytes long, and sends it to `c`.  With a
+ * window of one, waits for the client to apply it.  With a larger
+ * window the change is pipelined, and we only wait, for half the
+ * window to drain, once the window is full.  Returns 0, or -1 if the
+ * client is gone. */
+int mmu_client_prot(struct mmu_client *c, void *rep, size_t size)/*{{{*/
+{
+	pthread_mutex_lock(&c->lock);
+	uint32_t seq = ++c->sent;
+	/* all these replies start with their type and number */
+	memcpy((char *)rep + sizeof(uint32_t), &seq, sizeof(seq));
+	ssize_t cnt = mmu_client_send(c, rep, size);
+	int full = c->sent - c->acked >= (uint32_t)mmu->window;
+	pthread_mutex_unlock(&c->lock);
+	if(cnt != (ssize_t)size) {
+		mmu_client_destroy(c);
+		return -1;
+	}
+	if(!full) return 0;
+	return mmu_client_wait(c, seq - mmu->window/2);
+}/*}}}*/
+
+/* Records an operation that started at `start` and waited on the
+ * client, charging it to the fault being serviced. */
+void mmu_hist_rtt(enum hist_id id, uint64_t start)/*{{{*/
+{
+	uint64_t ns = hist_now() - start;
+	hist_record(id, ns);
+	hist_fault_add(HIST_FAULT_RTT, ns);
+}/*}}}*/
+
+void mmu_hist_disk(enum hist_id id, uint64_t start)/*{{{*/
+{
+	uint64_t ns = hist_now() - start;
+	hist_record(id, ns);
+	hist_fault_add(HIST_FAULT_DISK, ns);
+}/*}}}*/
+
 void mmu_zero_fill(int frame)/*{{{*/
 {
 	printf("%s frame %u\n", __func__, frame);
@@ -433,99 +1252,161 @@ void mmu_zero_fill(int frame)/*{{{*/
 
 void mmu_resident(pid_t pid, void *vaddr, int frame, int prot)/*{{{*/
 {
-	int id = get_pid_id(pid);
+	struct mmu_client *c = mmu_client_search(pid);
+	int id = c->id;
 	printf("%s pid %d vaddr %p prot %d frame %u\n", __func__,
 			id, vaddr, prot, frame);
 	logd(LOG_DEBUG, "%s pid %d vaddr %p prot %d frame %u\n", __func__,
 			id, vaddr, prot, frame);
-	struct mmu_client *c = mmu_client_search(pid);
 	struct mmu_proto_remap_rep rep;
 	rep.type = MMU_PROTO_REMAP_REP;
 	rep.prot = (int32_t)prot;
 	rep.offset = (uint64_t)(PAGESIZE * frame);
 	rep.vaddr = (intptr_t)vaddr;
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		goto out_client;
-
-	/* We need these functions to wait for the application to
-	 * effect the protection change before we return to the
-	 * pager.  This loop is necessary because mmu_client_thread
-	 * is already in the pager and blocked here (so we cannot
-	 * wait on a condition variable to be signaled forward as
-	 * there is no one else to recv the REMAP_REQ message).  An
-	 * alternative approach would be to use two sockets or
-	 * threads. */
-	uint32_t t;
-	do {
-		 if(recv(c->sock, &t, sizeof(t), MSG_PEEK) != sizeof(t))
-			goto out_client;
-	} while(t != MMU_PROTO_REMAP_REQ);
-	struct mmu_proto_remap_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
-		goto out_client;
-	assert(req.type == MMU_PROTO_REMAP_REQ);
-	return;
-
-	out_client:
-	mmu_client_destroy(c);
+	uint64_t start = hist_now();
+	/* Unless changes are pipelined, we wait for the application
+	 * to effect the protection change before we return to the
+	 * pager (see mmu_client_prot). */
+	if(mmu_client_prot(c, &rep, sizeof(rep)) == -1)
+		return;
+	mmu_hist_rtt(HIST_RESIDENT, start);
 }/*}}}*/
 
 
 void mmu_nonresident(pid_t pid, void *vaddr)/*{{{*/
 {
-	int id = get_pid_id(pid);
+	struct mmu_client *c = mmu_client_search(pid);
+	int id = c->id;
 	printf("%s pid %d vaddr %p\n", __func__, id, vaddr);
 	logd(LOG_DEBUG, "%s pid %d vaddr %p\n", __func__, id, vaddr);
-	struct mmu_client *c = mmu_client_search(pid);
 	struct mmu_proto_chprot_rep rep;
 	rep.type = MMU_PROTO_CHPROT_REP;
 	rep.prot = PROT_NONE;
 	rep.vaddr = (intptr_t)vaddr;
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		goto out_client;
-
-	uint32_t t;
-	do {
-		if(recv(c->sock, &t, sizeof(t), MSG_PEEK) != sizeof(t))
-			goto out_client;
-	} while(t != MMU_PROTO_CHPROT_REQ);
-	struct mmu_proto_chprot_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
-		goto out_client;
-	assert(req.type == MMU_PROTO_CHPROT_REQ);
-	return;
-
-	out_client:
-	mmu_client_destroy(c);
+	uint64_t start = hist_now();
+	if(mmu_client_prot(c, &rep, sizeof(rep)) == -1)
+		return;
+	mmu_hist_rtt(HIST_NONRESIDENT, start);
 }/*}}}*/
 
 void mmu_chprot(pid_t pid, void *vaddr, int prot)/*{{{*/
 {
-	int id = get_pid_id(pid);
+	struct mmu_client *c = mmu_client_search(pid);
+	int id = c->id;
 	printf("%s pid %d vaddr %p prot %d\n", __func__, id, vaddr, prot);
 	logd(LOG_DEBUG, "%s pid %d vaddr %p prot %d\n", __func__,
 			id, vaddr,prot);
-	struct mmu_client *c = mmu_client_search(pid);
 	struct mmu_proto_chprot_rep rep;
 	rep.type = MMU_PROTO_CHPROT_REP;
 	rep.prot = (int32_t)prot;
 	rep.vaddr = (intptr_t)vaddr;
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		goto out_client;
+	uint64_t start = hist_now();
+	if(mmu_client_prot(c, &rep, sizeof(rep)) == -1)
+		return;
+	mmu_hist_rtt(HIST_CHPROT, start);
+}/*}}}*/
 
-	uint32_t t;
-	do {
-		if(recv(c->sock, &t, sizeof(t), MSG_PEEK) != sizeof(t))
-			goto out_client;
-	} while(t != MMU_PROTO_CHPROT_REQ);
-	struct mmu_proto_chprot_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
-		goto out_client;
-	assert(req.type == MMU_PROTO_CHPROT_REQ);
-	return;
+void mmu_resident_vec(pid_t pid, void * const *vaddrs, const int *frames,
+		const int *prots, int n)/*{{{*/
+{
+	struct mmu_client *c = mmu_client_search(pid);
+	int id = c->id;
+	for(; n > 0; vaddrs += MMU_PROTO_VEC_MAX, frames += MMU_PROTO_VEC_MAX,
+			prots += MMU_PROTO_VEC_MAX, n -= MMU_PROTO_VEC_MAX) {
+		int count = n < MMU_PROTO_VEC_MAX ? n : MMU_PROTO_VEC_MAX;
+		struct {
+			struct mmu_proto_vec_rep h;
+			struct mmu_proto_remap_ent e[MMU_PROTO_VEC_MAX];
+		} __attribute__((packed)) rep;
+		rep.h.type = MMU_PROTO_REMAP_VEC_REP;
+		rep.h.count = (uint32_t)count;
+		flockfile(stdout);
+		for(int i = 0; i < count; i++) {
+			printf("%s pid %d vaddr %p prot %d frame %u\n", __func__,
+					id, vaddrs[i], prots[i], frames[i]);
+			rep.e[i].prot = (int32_t)prots[i];
+			rep.e[i].offset = (uint64_t)(PAGESIZE * frames[i]);
+			rep.e[i].vaddr = (intptr_t)vaddrs[i];
+		}
+		funlockfile(stdout);
+		logd(LOG_DEBUG, "%s pid %d count %d\n", __func__, id, count);
+		uint64_t start = hist_now();
+		if(mmu_client_prot(c, &rep, sizeof(rep.h) + count*sizeof(rep.e[0])) == -1)
+			return;
+		mmu_hist_rtt(HIST_RESIDENT, start);
+	}
+}/*}}}*/
 
-	out_client:
-	mmu_client_destroy(c);
+void mmu_chprot_vec(pid_t pid, void * const *vaddrs, const int *prots, int n)/*{{{*/
+{
+	struct mmu_client *c = mmu_client_search(pid);
+	int id = c->id;
+	for(; n > 0; vaddrs += MMU_PROTO_VEC_MAX, prots += MMU_PROTO_VEC_MAX,
+			n -= MMU_PROTO_VEC_MAX) {
+		int count = n < MMU_PROTO_VEC_MAX ? n : MMU_PROTO_VEC_MAX;
+		struct {
+			struct mmu_proto_vec_rep h;
+			struct mmu_proto_chprot_ent e[MMU_PROTO_VEC_MAX];
+		} __attribute__((packed)) rep;
+		rep.h.type = MMU_PROTO_CHPROT_VEC_REP;
+		rep.h.count = (uint32_t)count;
+		flockfile(stdout);
+		for(int i = 0; i < count; i++) {
+			printf("%s pid %d vaddr %p prot %d\n", __func__,
+					id, vaddrs[i], prots[i]);
+			rep.e[i].prot = (int32_t)prots[i];
+			rep.e[i].vaddr = (intptr_t)vaddrs[i];
+		}
+		funlockfile(stdout);
+		logd(LOG_DEBUG, "%s pid %d count %d\n", __func__, id, count);
+		uint64_t start = hist_now();
+		if(mmu_client_prot(c, &rep, sizeof(rep.h) + count*sizeof(rep.e[0])) == -1)
+			return;
+		mmu_hist_rtt(HIST_CHPROT, start);
+	}
+}/*}}}*/
+
+/* Clients are recycled once gone, so `c` is locked before the table
+ * is let go: it cannot be unhashed and handed to another process
+ * between the lookup and the lock. */
+void mmu_resume(pid_t pid)/*{{{*/
+{
+	pthread_rwlock_rdlock(&mmu->clients_lock);
+	struct mmu_client *c = mmu->pid2client[mmu_pid_hash(pid, mmu->npid2client)];
+	while(c && c->pid != pid) c = c->next_pid;
+	if(c) pthread_mutex_lock(&c->lock);
+	pthread_rwlock_unlock(&mmu->clients_lock);
+	/* the process may have exited while suspended */
+	if(!c) return;
+	if(c->pid != pid || !c->running) {
+		pthread_mutex_unlock(&c->lock);
+		return;
+	}
+	logd(LOG_DEBUG, "%s pid %d\n", __func__, c->id);
+	if(!c->parked) {
+		c->resumed = 1;
+	} else {
+		c->parked = 0;
+		if(!c->owned) {
+			c->owned = 1;
+			mmu_client_enqueue(c);
+		}
+	}
+	pthread_mutex_unlock(&c->lock);
+}/*}}}*/
+
+void mmu_sync(pid_t pid)/*{{{*/
+{
+	struct mmu_client *c = mmu_client_search(pid);
+	pthread_mutex_lock(&c->lock);
+	uint32_t seq = c->sent;
+	int done = seq == c->acked;
+	pthread_mutex_unlock(&c->lock);
+	if(done) return;
+	logd(LOG_DEBUG, "%s pid %d seq %u\n", __func__, c->id, seq);
+	uint64_t start = hist_now();
+	mmu_client_wait(c, seq);
+	hist_fault_add(HIST_FAULT_RTT, hist_now() - start);
 }/*}}}*/
 
 void mmu_disk_read(int block_from, int frame_to)/*{{{*/
@@ -534,8 +1415,10 @@ void mmu_disk_read(int block_from, int frame_to)/*{{{*/
 			block_from, frame_to);
 	logd(LOG_DEBUG, "%s from block %d to frame %d\n", __func__,
 			block_from, frame_to);
+	uint64_t start = hist_now();
 	memcpy(mmu->pmem + frame_to*PAGESIZE, mmu->disk + block_from*PAGESIZE,
 			PAGESIZE);
+	mmu_hist_disk(HIST_DISK_READ, start);
 }/*}}}*/
 
 void mmu_disk_write(int frame_from, int block_to)/*{{{*/
@@ -544,8 +1427,150 @@ void mmu_disk_write(int frame_from, int block_to)/*{{{*/
 			frame_from, block_to);
 	logd(LOG_DEBUG, "%s from frame %d to block %d\n", __func__,
 			frame_from, block_to);
+	uint64_t start = hist_now();
 	memcpy(mmu->disk + block_to*PAGESIZE, mmu->pmem + frame_from*PAGESIZE,
 			PAGESIZE);
+	mmu_hist_disk(HIST_DISK_WRITE, start);
+}/*}}}*/
+
+void mmu_disk_read_vec(int block_from, const int *frames_to, int n)/*{{{*/
+{
+	flockfile(stdout);
+	printf("%s from block %d count %d to frames", __func__,
+			block_from, n);
+	for(int i = 0; i < n; i++)
+		printf(" %d", frames_to[i]);
+	printf("\n");
+	funlockfile(stdout);
+	logd(LOG_DEBUG, "%s from block %d count %d\n", __func__,
+			block_from, n);
+	uint64_t start = hist_now();
+	const char *disk = mmu->disk + (size_t)block_from*PAGESIZE;
+	for(int i = 0; i < n; i++)
+		memcpy(mmu->pmem + frames_to[i]*PAGESIZE, disk + i*PAGESIZE,
+				PAGESIZE);
+	mmu_hist_disk(HIST_DISK_READ, start);
+}/*}}}*/
+
+void mmu_disk_write_vec(const int *frames_from, int block_to, int n)/*{{{*/
+{
+	flockfile(stdout);
+	printf("%s from frames", __func__);
+	for(int i = 0; i < n; i++)
+		printf(" %d", frames_from[i]);
+	printf(" to block %d count %d\n", block_to, n);
+	funlockfile(stdout);
+	logd(LOG_DEBUG, "%s to block %d count %d\n", __func__,
+			block_to, n);
+	uint64_t start = hist_now();
+	char *disk = mmu->disk + (size_t)block_to*PAGESIZE;
+	for(int i = 0; i < n; i++)
+		memcpy(disk + i*PAGESIZE, mmu->pmem + frames_from[i]*PAGESIZE,
+				PAGESIZE);
+	mmu_hist_disk(HIST_DISK_WRITE, start);
+}/*}}}*/
+
+void mmu_copy_frame(int frame_from, int frame_to)/*{{{*/
+{
+	printf("%s from frame %d to frame %d\n", __func__,
+			frame_from, frame_to);
+	logd(LOG_DEBUG, "%s from frame %d to frame %d\n", __func__,
+			frame_from, frame_to);
+	memcpy(mmu->pmem + frame_to*PAGESIZE, mmu->pmem + frame_from*PAGESIZE,
+			PAGESIZE);
+}/*}}}*/
+
+void mmu_zswap_init(int npages)/*{{{*/
+{
+	struct mmu_zswap *z = calloc(1, sizeof(*z));
+	if(z == NULL) logea(__FILE__, __LINE__, NULL);
+	pthread_mutex_init(&z->lock, NULL);
+	/* handles are at most one per chunk, keep them below 2^23 */
+	long nchunks = (long)npages * (PAGESIZE / MMU_ZSWAP_CHUNK);
+	z->nchunks = nchunks < (1 << 23) ? (int)nchunks : (1 << 23);
+	z->arena = malloc((size_t)z->nchunks * MMU_ZSWAP_CHUNK);
+	z->used = calloc(z->nchunks, sizeof(uint8_t));
+	z->first = malloc(z->nchunks * sizeof(int));
+	z->len = malloc(z->nchunks * sizeof(int));
+	z->free_handles = malloc(z->nchunks * sizeof(int));
+	if(!z->arena || !z->used || !z->first || !z->len || !z->free_handles)
+		logea(__FILE__, __LINE__, NULL);
+	for(int i = 0; i < z->nchunks; i++)
+		z->free_handles[i] = z->nchunks - 1 - i;
+	z->nfree = z->nchunks;
+	logd(LOG_INFO, "%s: %d pages %d chunks\n", __func__, npages,
+			z->nchunks);
+	mmu->zswap = z;
+}/*}}}*/
+
+/* Finds and marks `need` contiguous free chunks, returning the first
+ * or -1.  Called with the pool lock held. */
+static int mmu_zswap_alloc(struct mmu_zswap *z, int need)/*{{{*/
+{
+	for(int pass = 0; pass < 2; pass++) {
+		int from = pass ? 0 : z->cursor;
+		int to = pass ? z->cursor + need - 1 : z->nchunks;
+		if(to > z->nchunks) to = z->nchunks;
+		int run = 0;
+		for(int i = from; i < to; i++) {
+			run = z->used[i] ? 0 : run + 1;
+			if(run < need) continue;
+			int first = i - need + 1;
+			memset(z->used + first, 1, need);
+			z->cursor = (i + 1) % z->nchunks;
+			return first;
+		}
+	}
+	return -1;
+}/*}}}*/
+
+int mmu_zswap_store(int frame)/*{{{*/
+{
+	struct mmu_zswap *z = mmu->zswap;
+	char buf[MMU_ZSWAP_MAXLEN(PAGESIZE)];
+	size_t n = lz_compress(mmu->pmem + frame*PAGESIZE, PAGESIZE, buf,
+			sizeof(buf));
+	int handle = -1;
+	if(n > 0) {
+		int need = (n + MMU_ZSWAP_CHUNK - 1) / MMU_ZSWAP_CHUNK;
+		pthread_mutex_lock(&z->lock);
+		int first = z->nfree > 0 ? mmu_zswap_alloc(z, need) : -1;
+		if(first != -1) {
+			handle = z->free_handles[--z->nfree];
+			z->first[handle] = first;
+			z->len[handle] = (int)n;
+		}
+		pthread_mutex_unlock(&z->lock);
+		if(first != -1)
+			memcpy(z->arena + (size_t)first*MMU_ZSWAP_CHUNK, buf, n);
+	}
+	printf("%s frame %d handle %d size %zu\n", __func__, frame,
+			handle, n);
+	logd(LOG_DEBUG, "%s frame %d handle %d size %zu\n", __func__,
+			frame, handle, n);
+	return handle;
+}/*}}}*/
+
+void mmu_zswap_load(int handle, int frame)/*{{{*/
+{
+	struct mmu_zswap *z = mmu->zswap;
+	printf("%s handle %d to frame %d\n", __func__, handle, frame);
+	logd(LOG_DEBUG, "%s handle %d to frame %d\n", __func__, handle,
+			frame);
+	long n = lz_decompress(z->arena + (size_t)z->first[handle]*MMU_ZSWAP_CHUNK,
+			z->len[handle], mmu->pmem + frame*PAGESIZE, PAGESIZE);
+	assert(n == (long)PAGESIZE);
+}/*}}}*/
+
+void mmu_zswap_free(int handle)/*{{{*/
+{
+	struct mmu_zswap *z = mmu->zswap;
+	logd(LOG_DEBUG, "%s handle %d\n", __func__, handle);
+	pthread_mutex_lock(&z->lock);
+	int need = (z->len[handle] + MMU_ZSWAP_CHUNK - 1) / MMU_ZSWAP_CHUNK;
+	memset(z->used + z->first[handle], 0, need);
+	z->free_handles[z->nfree++] = handle;
+	pthread_mutex_unlock(&z->lock);
 }/*}}}*/
 /*}}}*/
 
@@ -556,26 +1581,72 @@ void mmu_disk_write(int frame_from, int block_to)/*{{{*/
 void pager_free(void);
 #endif
 void usage(int argc, char **argv) {/*{{{*/
-	printf("usage: %s NFRAMES NBLOCKS\n", argv[0]);
+	printf("usage: %s [-p POLICY] [-w WORKERS] [-a WINDOW] "
+			"[-o NAME=VALUE]... NFRAMES NBLOCKS\n", argv[0]);
 	printf("\n");
-	printf("valid ranges: 2 <= NFRAMES <= 256\n");
+	printf("valid ranges: 2 <= NFRAMES <= %d\n", MMU_MAX_FRAMES);
 	printf("              4 <= NBLOCKS <= 1024\n");
+	printf("              1 <= WORKERS <= %d (default %d)\n",
+			MMU_MAX_WORKERS, MMU_DEFAULT_WORKERS);
+	printf("              1 <= WINDOW <= %d (default 1)\n",
+			MMU_MAX_WINDOW);
+	printf("with -a, up to WINDOW protection changes per process are sent\n");
+	printf("without waiting for the process to apply them\n");
+	printf("policies: %s (default clock)\n", policy_names);
 	exit(EXIT_FAILURE);
 }/*}}}*/
 
+/* Passes `-o NAME=VALUE` to the pager. */
+static void mmu_pager_option(int argc, char **argv, char *opt) {/*{{{*/
+	char *value = strchr(opt, '=');
+	if(!value) usage(argc, argv);
+	*value++ = '\0';
+	if(pager_option(opt, value) == -1) {
+		printf("invalid option %s=%s\n", opt, value);
+		usage(argc, argv);
+	}
+}/*}}}*/
+
 int main(int argc, char **argv) {/*{{{*/
-	if(argc != 3) usage(argc, argv);
-	int npages = atoi(argv[1]);
-	if(npages < 1 || npages > 256) usage(argc, argv);
-	int nblocks = atoi(argv[2]);
+	int opt;
+	int nworkers = MMU_DEFAULT_WORKERS;
+	int window = 1;
+	while((opt = getopt(argc, argv, "p:w:a:o:")) != -1) {
+		switch(opt) {
+		case 'p':
+			if(pager_option("policy", optarg) == -1)
+				usage(argc, argv);
+			break;
+		case 'w':
+			nworkers = atoi(optarg);
+			if(nworkers < 1 || nworkers > MMU_MAX_WORKERS)
+				usage(argc, argv);
+			break;
+		case 'a':
+			window = atoi(optarg);
+			if(window < 1 || window > MMU_MAX_WINDOW)
+				usage(argc, argv);
+			break;
+		case 'o':
+			mmu_pager_option(argc, argv, optarg);
+			break;
+		default:
+			usage(argc, argv);
+		}
+	}
+	if(argc - optind != 2) usage(argc, argv);
+	int npages = atoi(argv[optind]);
+	if(npages < 1 || npages > MMU_MAX_FRAMES) usage(argc, argv);
+	int nblocks = atoi(argv[optind+1]);
 	if(nblocks < 2 || nblocks > 1024) usage(argc, argv);
 	#ifdef MMULOG
 	log_init(LOG_EXTRA, "mmu.log", 1, 1<<20);
 	#endif
-	memset(id2pid, 255, UINT8_MAX * sizeof(pid_t));
-	mmu_init(npages, nblocks);
+	mmu_init(npages, nblocks, nworkers, window);
 	pager_init(npages, nblocks);
 	mmu_accept_loop();
+	pager_report();
+	hist_dump();
 	#ifdef MMUFREE
 	pager_free();
 	#endif
@@ -25,7 +25,8 @@ extern const char *pmem;
 
 /* All functions in this module are blocking, i.e., they only return after
  * changes to physical memory, disk, and program virtual addresses are
- * complete.  */
+ * complete.  The exception are protection changes when the MMU
+ * pipelines them; see `mmu_sync`.  */
 
 /* `mmu_zero_fill` will fill `frame` with zeroes (character '0').
  * Your page should use this function to initialize memory before
@@ -49,6 +50,32 @@ void mmu_nonresident(pid_t pid, void *vaddr);
  * on `vaddr` and `prot`.  */
 void mmu_chprot(pid_t pid, void *vaddr, int prot);
 
+/* `mmu_resident_vec` and `mmu_chprot_vec` apply `n` changes to the
+ * pages of process `pid` in a single round trip: page `vaddrs[i]` is
+ * mapped to `frames[i]`, or has its permissions changed, with
+ * protection `prots[i]`, as by `n` calls to `mmu_resident` or
+ * `mmu_chprot`.  `n` should be at most `MMU_VEC_MAX`.  The process
+ * merges changes to adjacent pages, so pagers should list pages in
+ * address order.  */
+#define MMU_VEC_MAX 256
+void mmu_resident_vec(pid_t pid, void * const *vaddrs, const int *frames,
+		const int *prots, int n);
+void mmu_chprot_vec(pid_t pid, void * const *vaddrs, const int *prots, int n);
+
+/* When the MMU pipelines protection changes (`-a WINDOW`),
+ * `mmu_resident`, `mmu_nonresident` and `mmu_chprot` may return
+ * before process `pid` has applied the change.  `mmu_sync` waits
+ * until `pid` has applied every change sent to it.  Your pager should
+ * call it after revoking access to a frame and before reading or
+ * writing the frame or giving it to another page.  Otherwise it
+ * returns at once.  */
+void mmu_sync(pid_t pid);
+
+/* `mmu_resume` makes the infrastructure retry the request of process
+ * `pid` that the pager deferred (see `pager_fault`).  Pagers call it
+ * once the process may run again.  */
+void mmu_resume(pid_t pid);
+
 /* `mmu_disk_read` copies content from disk block `block_from` into
  * physical frame `frame_to`.  `mmu_disk_write` copies content from
  * frame `frame_from` to disk block `block_to`.  Your pager shoudl
@@ -56,4 +83,35 @@ void mmu_chprot(pid_t pid, void *vaddr, int prot);
 void mmu_disk_read(int block_from, int frame_to);
 void mmu_disk_write(int frame_from, int block_to);
 
+/* `mmu_disk_read_vec` copies the `n` consecutive disk blocks starting
+ * at `block_from` into frames `frames_to[0]` to `frames_to[n-1]`, and
+ * `mmu_disk_write_vec` copies frames `frames_from[0]` to
+ * `frames_from[n-1]` into the `n` consecutive blocks starting at
+ * `block_to`.  Each is a single sequential disk transfer, cheaper
+ * than `n` calls to `mmu_disk_read` or `mmu_disk_write`.  */
+void mmu_disk_read_vec(int block_from, const int *frames_to, int n);
+void mmu_disk_write_vec(const int *frames_from, int block_to, int n);
+
+/* `mmu_copy_frame` copies the contents of frame `frame_from` into
+ * frame `frame_to`.  Pagers that share frames between pages use it to
+ * give a page its own copy before it is written.  */
+void mmu_copy_frame(int frame_from, int frame_to);
+
+/* The MMU can keep compressed copies of frames in a pool of memory
+ * separate from physical memory, as a fast swap tier in front of the
+ * disk.  `mmu_zswap_init` creates a pool of `npages` pages; call it
+ * once before using the other functions.
+ *
+ * `mmu_zswap_store` compresses `frame` into the pool and returns a
+ * handle for it, or -1 if the frame does not compress to at most
+ * `MMU_ZSWAP_MAXLEN` bytes or the pool is full.  `mmu_zswap_load`
+ * decompresses the page stored under `handle` into `frame`, and
+ * `mmu_zswap_free` releases the handle and its space.  Handles are
+ * nonnegative and smaller than 2^23.  */
+#define MMU_ZSWAP_MAXLEN(pagesize) ((pagesize) * 3 / 4)
+void mmu_zswap_init(int npages);
+int mmu_zswap_store(int frame);
+void mmu_zswap_load(int handle, int frame);
+void mmu_zswap_free(int handle);
+
 #endif
@@ -23,7 +23,35 @@
  * The `REMAP` and `CHPROT` messages are generated by the MMU and
  * are processed by `uvm_thread` asynchronously.  These messages are
  * used to service sergmentation faults and whenever the pager pages
- * some of the processes pages to disk. */
+ * some of the processes pages to disk.  The MMU numbers them in `seq`,
+ * and the client acknowledges each one, once applied, with a `REMAP`
+ * or `CHPROT` request carrying the same number.  By default the MMU
+ * waits for each acknowledgement; when it pipelines protection
+ * changes, several may be in flight and acknowledgements are read as
+ * they arrive.  The client applies changes in the order sent.
+ *
+ * The `REMAP_VEC` and `CHPROT_VEC` messages carry `count` changes of
+ * the same kind for one client, at most `MMU_PROTO_VEC_MAX`, in
+ * entries that follow the header.  The client applies them as a
+ * batch, merging changes to adjacent pages, and acknowledges the
+ * whole message once with a `REMAP` or `CHPROT` request carrying its
+ * number.
+ *
+ * The `EXTEND_N` message allocates several contiguous pages in one
+ * round trip; its reply carries the address of the first page.
+ *
+ * The `RELEASE` message discards the contents of a range of the
+ * client's pages, returning their frames and blocks to the MMU; see
+ * `uvm_release`.
+ *
+ * The `QUOTA` message sets the minimum and maximum number of frames
+ * the client's pages may hold; see `uvm_set_quota`.
+ *
+ * The `RING` message, sent right after `CREATE` with a memfd attached
+ * (SCM_RIGHTS), moves the client to the shared-memory transport in
+ * ring.h.  If the reply's `retcode` is zero, every later message goes
+ * through the rings in the memfd; the socket is only used for doorbells
+ * and to tell when either side is gone. */
 
 #ifndef __MMUPROTO_HEADER__
 #define __MMUPROTO_HEADER__
@@ -44,6 +72,16 @@
 #define MMU_PROTO_REMAP_REP 10
 #define MMU_PROTO_CHPROT_REQ 11
 #define MMU_PROTO_CHPROT_REP 12
+#define MMU_PROTO_QUOTA_REQ 13
+#define MMU_PROTO_QUOTA_REP 14
+#define MMU_PROTO_EXTEND_N_REQ 15
+#define MMU_PROTO_EXTEND_N_REP 16
+#define MMU_PROTO_RELEASE_REQ 17
+#define MMU_PROTO_RELEASE_REP 18
+#define MMU_PROTO_REMAP_VEC_REP 20
+#define MMU_PROTO_CHPROT_VEC_REP 22
+#define MMU_PROTO_RING_REQ 23
+#define MMU_PROTO_RING_REP 24
 #define MMU_PROTO_EXIT_REQ 32
 #define MMU_PROTO_EXIT_REP 33
 
@@ -64,6 +102,25 @@ struct mmu_proto_extend_rep {
 	uint64_t vaddr;
 } __attribute__((packed));
 
+struct mmu_proto_extend_n_req {
+	uint32_t type;
+	uint32_t count;
+} __attribute__((packed));
+struct mmu_proto_extend_n_rep {
+	uint32_t type;
+	uint64_t vaddr;
+} __attribute__((packed));
+
+struct mmu_proto_release_req {
+	uint32_t type;
+	uint32_t npages;
+	uint64_t addr;
+} __attribute__((packed));
+struct mmu_proto_release_rep {
+	uint32_t type;
+	int32_t retcode;
+} __attribute__((packed));
+
 struct mmu_proto_syslog_req {
 	uint32_t type;
 	uint32_t len;
@@ -74,9 +131,17 @@ struct mmu_proto_syslog_rep {
 	uint32_t retcode;
 } __attribute__((packed));
 
+/* `access` tells whether the faulting instruction was reading or
+ * writing, when the client can tell (MMU_PROTO_ACCESS_UNKNOWN
+ * otherwise). */
+#define MMU_PROTO_ACCESS_UNKNOWN 0
+#define MMU_PROTO_ACCESS_READ 1
+#define MMU_PROTO_ACCESS_WRITE 2
+
 struct mmu_proto_segv_req {
 	uint32_t type;
 	int32_t code;
+	uint32_t access;
 	uint64_t addr;
 } __attribute__((packed));
 struct mmu_proto_segv_rep {
@@ -86,9 +151,11 @@ struct mmu_proto_segv_rep {
 
 struct mmu_proto_remap_req {
 	uint32_t type;
+	uint32_t seq;
 } __attribute__((packed));
 struct mmu_proto_remap_rep {
 	uint32_t type;
+	uint32_t seq;
 	int32_t prot;
 	uint64_t offset;
 	uint64_t vaddr;
@@ -96,13 +163,50 @@ struct mmu_proto_remap_rep {
 
 struct mmu_proto_chprot_req {
 	uint32_t type;
+	uint32_t seq;
 } __attribute__((packed));
 struct mmu_proto_chprot_rep {
 	uint32_t type;
+	uint32_t seq;
 	int32_t prot;
 	uint64_t vaddr;
 } __attribute__((packed));
 
+#define MMU_PROTO_VEC_MAX 256 /* pages of a client, see UVM_MAXADDR */
+
+struct mmu_proto_vec_rep {
+	uint32_t type;
+	uint32_t seq;
+	uint32_t count;
+} __attribute__((packed));
+struct mmu_proto_remap_ent {
+	int32_t prot;
+	uint64_t offset;
+	uint64_t vaddr;
+} __attribute__((packed));
+struct mmu_proto_chprot_ent {
+	int32_t prot;
+	uint64_t vaddr;
+} __attribute__((packed));
+
+struct mmu_proto_quota_req {
+	uint32_t type;
+	int32_t min;
+	int32_t max;
+} __attribute__((packed));
+struct mmu_proto_quota_rep {
+	uint32_t type;
+	int32_t retcode;
+} __attribute__((packed));
+
+struct mmu_proto_ring_req {
+	uint32_t type;
+} __attribute__((packed));
+struct mmu_proto_ring_rep {
+	uint32_t type;
+	int32_t retcode;
+} __attribute__((packed));
+
 struct mmu_proto_exit_req {
 	uint32_t type;
 } __attribute__((packed));
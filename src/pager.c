@@ -3,14 +3,21 @@
 #include <sys/mman.h>
 
 #include <assert.h>
+#include <errno.h>
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <time.h>
 
+#include "hist.h"
+#include "log.h"
 #include "mmu.h"
+#include "policy.h"
 
 #define NUM_PAGES (UVM_MAXADDR - UVM_BASEADDR + 1) / PAGE_SIZE
 
@@ -22,55 +29,644 @@ int addr_to_page(void * vaddr) {
   return ((long int)vaddr - UVM_BASEADDR) / sysconf(_SC_PAGESIZE) ;
 }
 
-struct frame_data {
+/* Locking.  Each process has a lock protecting its page table and the
+ * metadata of the frames it owns.  `clock_lock` serializes the clock
+ * hand and evictions, `frames_lock` and `blocks_lock` protect the
+ * free-frame and free-block stacks, and `table_lock` protects the pid
+ * table and the process slab.  Locks are taken in the order
+ * clock_lock -> table_lock -> proc->lock -> frames_lock/blocks_lock,
+ * so faults release their own process lock before evicting.
+ *
+ * A frame's owner pid is -1 while it is free or being filled; the
+ * clock skips such frames.  It is only changed with the owner's lock
+ * held, and read by the clock without it, so it is accessed
+ * atomically.  Frames merged by the KSM scanner are owned by
+ * FRAME_KSM instead; see `ksm_merge`. */
+#define FRAME_KSM -2
+
+/* Page table entries are packed into 8 bytes: the backing block (-1
+ * if none was allocated yet, see `lazyswap`), the frame holding the
+ * page (-1 if not resident) and PAGE_* flags.
+ * PAGE_ON_DISK means the block holds the page's contents; if the page
+ * is resident in a dirty frame, the frame is newer.  PAGE_PREFETCHED
+ * marks pages loaded by readahead that were not yet known to be used.
+ * PAGE_ZERO marks never-written pages mapped read-only to the shared
+ * zero frame; they have no frame of their own.  PAGE_ZSWAP marks pages
+ * held compressed by the MMU; `frame` is then their zswap handle, so
+ * residency must be checked with `page_frame`.  PAGE_KSM marks pages
+ * mapped read-only to a frame shared by the KSM scanner. */
+#define PAGE_ON_DISK 0x01
+#define PAGE_PREFETCHED 0x02
+#define PAGE_ZERO 0x04
+#define PAGE_ZSWAP 0x08
+#define PAGE_KSM 0x10
+
+struct page_data {
+	int32_t block;
+	int32_t frame : 24;
+	uint32_t flags : 8;
+};
+_Static_assert(sizeof(struct page_data) == 8, "page_data should be packed");
+
+/* Returns the frame holding the page, or -1 if it is not resident. */
+static int page_frame(const struct page_data *pdata){
+  return (pdata->flags & PAGE_ZSWAP) ? -1 : pdata->frame;
+}
+
+/* Pages mapping a shared frame, kept in a list per frame; sharing
+ * saves a frame for every mapper beyond the first.  `clean` means the
+ * page's frame was clean when merged, so its block (or the zero fill,
+ * if never written out) already holds the contents. */
+struct ksm_mapper {
 	pid_t pid;
 	int page;
-	int prot; 
-	int dirty; 
-	int reference_bit; 
+	int clean;
+	struct ksm_mapper *next;
 };
 
-struct page_data {
-	int block;
-	int on_disk; 
-	int frame;
-};
+/* Processes and their page tables are allocated together, with room
+ * for `maxpages` entries, so `pager_extend` never reallocates.
+ * `refcnt` counts the pid table plus every thread using the process;
+ * the last `proc_put` returns it to the slab.  `ra_*` track the
+ * sequential fault stream for readahead: the page expected to fault
+ * next, the first page of the last readahead and its window.  `rss`
+ * counts the frames the process owns (shared frames are nobody's);
+ * `rss_min` of them are protected from other processes' faults, and
+ * at `rss_max` its faults replace its own pages, found by the local
+ * clock hand `rss_hand`.  A zero `rss_max` means no limit.  `ws_bits`
+ * marks the pages that faulted since load control last looked, and
+ * `ws` is their count then; see `loadctl`.  `deferred` is set when a
+ * fault of the suspended process was deferred.  With `swapcluster`, the
+ * process takes blocks in order from `swap_next` up to `swap_end`, the
+ * rest of the swap cluster it last allocated from; they are protected
+ * by `blocks_lock`. */
+#define PROC_WS_WORDS 4 /* 256 pages, see UVM_MAXADDR */
 
 struct proc {
 	pid_t pid;
 	int npages;
 	int maxpages;
-	struct page_data *pages;
+	int ra_next;
+	int ra_start;
+	int ra_window;
+	int rss;
+	int rss_peak;
+	int rss_min;
+	int rss_max;
+	int rss_hand;
+	long faults;
+	long major_faults;
+	long local_evictions;
+	uint64_t ws_bits[PROC_WS_WORDS];
+	int ws;
+	long ws_faults;
+	long ws_major_faults;
+	int suspended;
+	int deferred;
+	long active_since;
+	int swap_next;
+	int swap_end;
+	int dead;
+	int refcnt;
+	pthread_mutex_t lock;
+	struct proc *next_free;
+	struct page_data pages[];
 };
 
+/* Processes all have the same size; they are carved out of slabs of
+ * PROC_SLAB_COUNT and recycled through a free list. */
+#define PROC_SLAB_COUNT 16
+
+/* Open-addressing (linear probing) hash table from pid to process.
+ * Slots are NULL when never used and PROC_DEAD after the process in
+ * it was destroyed; dead slots are reused by later inserts. */
+#define PROC_DEAD (&proc_tombstone)
+#define PROC_TABLE_MINSIZE 64
+
+static struct proc proc_tombstone;
+
+struct proc_table {
+	int size;
+	int used;
+	int dead;
+	struct proc **slots;
+};
+
+/* A page whose reference bit the clock cleared, with `protvec`.  Its
+ * access is revoked when the sweep ends, together with the other pages
+ * of its process; see `aged_flush`. */
+struct aged_page {
+	pid_t pid;
+	int page;
+	int frame;
+};
+
+/* Event counters, updated atomically and logged by `pager_report`. */
+struct pager_stats {
+	long faults;
+	long minor_faults;
+	long zero_fills;
+	long disk_reads;
+	long disk_writes;
+	long evictions;
+	long direct_reclaims;
+	long background_reclaims;
+	long kswapd_wakeups;
+	long writeback_scans;
+	long writeback_pages;
+	long clean_evictions;
+	long dirty_evictions;
+	long readahead_pages;
+	long readahead_hits;
+	long readahead_misses;
+	long write_faults;
+	long zero_maps;
+	long zero_cows;
+	long zswap_stores;
+	long zswap_rejects;
+	long zswap_loads;
+	long ksm_scans;
+	long ksm_scan_ns;
+	long ksm_merges;
+	long ksm_cows;
+	long ksm_reuses;
+	long ksm_writes_saved;
+	long block_shortages;
+	long blocks_reclaimed;
+	long oom_kills;
+	long local_evictions;
+	long reserve_skips;
+	long loadctl_periods;
+	long loadctl_thrashing;
+	long loadctl_suspends;
+	long loadctl_resumes;
+	long loadctl_deferred;
+	long loadctl_swapped;
+	long released_pages;
+	long released_frames;
+	long cluster_allocs;
+	long cluster_writes;
+	long cluster_write_pages;
+	long cluster_reads;
+	long cluster_read_pages;
+	long protvec_msgs;
+	long protvec_pages;
+};
+
+#define STAT_INC(field) __atomic_add_fetch(&my_pager.stats.field, 1, __ATOMIC_RELAXED)
+
 struct pager {
-	pthread_mutex_t mutex;
+	pthread_mutex_t clock_lock;
+	pthread_mutex_t frames_lock;
+	pthread_mutex_t blocks_lock;
+	pthread_rwlock_t table_lock;
+	pthread_cond_t kswapd_cond;
+	pthread_mutex_t ksm_lock;
+	pthread_mutex_t loadctl_lock;
+	long loadctl_period;
 	int nframes;
 	int frames_free;
-	struct frame_data *frames; 
-	int *free_frames_stack; 
+	int zero_frame;
+	/* frame metadata, indexed by frame: the owner, the page and its
+	 * protection, and bitmaps of reference, dirty and resident (has
+	 * an owner) bits.  Frames of different processes share bitmap
+	 * words, so bits are updated atomically. */
+	pid_t *frame_pid;
+	int32_t *frame_page;
+	uint8_t *frame_prot;
+	uint64_t *ref_bits;
+	uint64_t *dirty_bits;
+	uint64_t *resident_bits;
+	int *free_frames_stack;
 	int nblocks;
 	int blocks_free;
-  int *blocks_free_stack; 
+	long committed;
+	long commit_limit;
+	int block_shortage;
+	int reserve_skip;
+  int *blocks_free_stack;
+	/* with `swapcluster`, free blocks are a bitmap instead of a stack,
+	 * with the number of free blocks in each cluster */
+	uint64_t *block_free_bits;
+	int *cluster_free;
+	int nclusters;
 	pid_t *block2pid;
   int n_procs;
-	struct proc *pid2proc;
-  int second_chance_idx;
+	struct proc_table pid2proc;
+	const struct policy *policy;
+	struct proc *free_procs;
+	struct pager_stats stats;
+	struct ksm_mapper **ksm_mappers;
+	uint32_t *ksm_sums;
+	int *ksm_table;
+	int ksm_table_size;
+	int ksm_saved;
+	int ksm_saved_max;
+	/* with `protvec`, revocations queued by the clock (see
+	 * `aged_flush`), protected by `clock_lock` */
+	struct aged_page *aged;
+	int naged;
 };
 
-struct pager my_pager;
+struct pager my_pager = {
+	.clock_lock = PTHREAD_MUTEX_INITIALIZER,
+	.frames_lock = PTHREAD_MUTEX_INITIALIZER,
+	.blocks_lock = PTHREAD_MUTEX_INITIALIZER,
+	.table_lock = PTHREAD_RWLOCK_INITIALIZER,
+	.kswapd_cond = PTHREAD_COND_INITIALIZER,
+	.ksm_lock = PTHREAD_MUTEX_INITIALIZER,
+	.loadctl_lock = PTHREAD_MUTEX_INITIALIZER,
+	.policy = NULL,
+};
 
-void pager_init(int nframes, int nblocks){
-  pthread_mutex_lock(&my_pager.mutex);
+/* Tunables set with `pager_option`.  The background pageout thread
+ * (kswapd) runs when `lowmark` is nonzero: it wakes when fewer than
+ * `lowmark` frames are free and evicts until `highmark` are.  The
+ * writeback thread runs every `writeback` milliseconds if nonzero.
+ * Sequential fault streams prefetch up to `readahead` pages.  With
+ * `writefault`, write faults map pages read-write directly.  With
+ * `zeroframe`, untouched pages are read from a shared zero frame and
+ * only get a frame of their own when first written.  With `zswap`,
+ * dirty evicted pages are compressed into a pool of that many pages
+ * kept by the MMU, and only written to disk when the pool is full.
+ * Every `ksm` milliseconds, the KSM scanner merges identical frames.
+ * With `lazyswap`, pages get a block only when first written out, and
+ * processes may extend while the pages in use stay under `overcommit`
+ * percent (100 if unset) of the frames plus blocks, less one block:
+ * a page being swapped in holds its block until it is resident, so
+ * the victim it replaces needs a spare one.  `rssmin` and `rssmax`
+ * are the default quotas of new processes; see `pager_set_quota`.
+ * Every `loadctl` milliseconds, load control checks for thrashing and
+ * suspends or resumes processes.  With `swapcluster`, blocks are
+ * grouped in clusters of that many and each process fills a cluster
+ * of its own, so neighbouring pages get neighbouring blocks and are
+ * written out and read ahead in one disk transfer.  With `protvec`,
+ * the clock revokes access in one vectored change per process at the
+ * end of each sweep, and clustered readahead maps its pages with one. */
+struct pager_config {
+	int lowmark;
+	int highmark;
+	int writeback;
+	int readahead;
+	int writefault;
+	int zeroframe;
+	int zswap;
+	int ksm;
+	int lazyswap;
+	int overcommit;
+	int rssmin;
+	int rssmax;
+	int loadctl;
+	int swapcluster;
+	int protvec;
+};
+
+static struct pager_config my_config;
+
+static const struct {
+	const char *name;
+	int *value;
+} pager_int_options[] = {
+	{ "lowmark", &my_config.lowmark },
+	{ "highmark", &my_config.highmark },
+	{ "writeback", &my_config.writeback },
+	{ "readahead", &my_config.readahead },
+	{ "writefault", &my_config.writefault },
+	{ "zeroframe", &my_config.zeroframe },
+	{ "zswap", &my_config.zswap },
+	{ "ksm", &my_config.ksm },
+	{ "lazyswap", &my_config.lazyswap },
+	{ "overcommit", &my_config.overcommit },
+	{ "rssmin", &my_config.rssmin },
+	{ "rssmax", &my_config.rssmax },
+	{ "loadctl", &my_config.loadctl },
+	{ "swapcluster", &my_config.swapcluster },
+	{ "protvec", &my_config.protvec },
+};
+
+static void kswapd_start(void);
+static void writeback_start(void);
+static void ksm_start(void);
+static void loadctl_start(void);
+static int ksm_evict(int frame);
+
+static unsigned proc_hash(pid_t pid, int size){
+  return ((unsigned)pid * 2654435761u) & (size - 1);
+}
+
+/* Called with `table_lock` held for writing. */
+static struct proc *proc_alloc(void){
+  int maxpages = addr_to_page((void *)UVM_MAXADDR);
+  size_t procsz = sizeof(struct proc) + maxpages*sizeof(struct page_data);
+  if (my_pager.free_procs == NULL){
+    char *slab = malloc(procsz*PROC_SLAB_COUNT);
+    for (int i = PROC_SLAB_COUNT-1; i >= 0; i--){
+      struct proc *proc = (struct proc *)(slab + i*procsz);
+      pthread_mutex_init(&proc->lock, NULL);
+      proc->next_free = my_pager.free_procs;
+      my_pager.free_procs = proc;
+    }
+  }
+  struct proc *proc = my_pager.free_procs;
+  my_pager.free_procs = proc->next_free;
+  proc->npages = 0;
+  proc->maxpages = maxpages;
+  proc->ra_next = -1;
+  proc->ra_start = 0;
+  proc->ra_window = 0;
+  proc->rss = 0;
+  proc->rss_peak = 0;
+  proc->rss_min = my_config.rssmin;
+  proc->rss_max = my_config.rssmax;
+  proc->rss_hand = 0;
+  proc->faults = 0;
+  proc->major_faults = 0;
+  proc->local_evictions = 0;
+  memset(proc->ws_bits, 0, sizeof(proc->ws_bits));
+  proc->ws = 0;
+  proc->ws_faults = 0;
+  proc->ws_major_faults = 0;
+  proc->suspended = 0;
+  proc->deferred = 0;
+  proc->active_since = 0;
+  proc->swap_next = 0;
+  proc->swap_end = 0;
+  proc->dead = 0;
+  proc->refcnt = 1;
+  proc->next_free = NULL;
+  return proc;
+}
+
+static void proc_put(struct proc *proc){
+  if (__atomic_sub_fetch(&proc->refcnt, 1, __ATOMIC_ACQ_REL) > 0)
+    return;
+  pthread_rwlock_wrlock(&my_pager.table_lock);
+  proc->next_free = my_pager.free_procs;
+  my_pager.free_procs = proc;
+  pthread_rwlock_unlock(&my_pager.table_lock);
+}
+
+static void proc_table_init(struct proc_table *t, int size){
+  t->size = size;
+  t->used = 0;
+  t->dead = 0;
+  t->slots = calloc(size, sizeof(struct proc *));
+}
+
+/* Called with `table_lock` held. */
+static struct proc *proc_lookup(pid_t pid){
+  struct proc_table *t = &my_pager.pid2proc;
+  for (unsigned i = proc_hash(pid, t->size); t->slots[i] != NULL; i = (i+1) & (t->size-1)){
+    if (t->slots[i] != PROC_DEAD && t->slots[i]->pid == pid)
+      return t->slots[i];
+  }
+  return NULL;
+}
+
+/* Returns process `pid` with a reference taken, or NULL.  The caller
+ * must `proc_put` it when done. */
+static struct proc *proc_get(pid_t pid){
+  pthread_rwlock_rdlock(&my_pager.table_lock);
+  struct proc *proc = proc_lookup(pid);
+  if (proc != NULL)
+    __atomic_add_fetch(&proc->refcnt, 1, __ATOMIC_ACQ_REL);
+  pthread_rwlock_unlock(&my_pager.table_lock);
+  return proc;
+}
+
+static void proc_table_insert(struct proc_table *t, struct proc *proc);
+
+/* Rehashes into a table sized for the live processes, dropping
+ * dead slots along the way. */
+static void proc_table_resize(struct proc_table *t){
+  struct proc_table old = *t;
+  int size = PROC_TABLE_MINSIZE;
+  while (size < 4*(old.used+1))
+    size *= 2;
+  proc_table_init(t, size);
+  for (int i = 0; i < old.size; i++){
+    if (old.slots[i] != NULL && old.slots[i] != PROC_DEAD)
+      proc_table_insert(t, old.slots[i]);
+  }
+  free(old.slots);
+}
+
+static void proc_table_insert(struct proc_table *t, struct proc *proc){
+  if (4*(t->used + t->dead + 1) > 3*t->size)
+    proc_table_resize(t);
+  unsigned i = proc_hash(proc->pid, t->size);
+  while (t->slots[i] != NULL && t->slots[i] != PROC_DEAD)
+    i = (i+1) & (t->size-1);
+  if (t->slots[i] == PROC_DEAD)
+    t->dead--;
+  t->slots[i] = proc;
+  t->used++;
+}
+
+static struct proc *proc_table_remove(struct proc_table *t, pid_t pid){
+  for (unsigned i = proc_hash(pid, t->size); t->slots[i] != NULL; i = (i+1) & (t->size-1)){
+    if (t->slots[i] != PROC_DEAD && t->slots[i]->pid == pid){
+      struct proc *proc = t->slots[i];
+      t->slots[i] = PROC_DEAD;
+      t->used--;
+      t->dead++;
+      return proc;
+    }
+  }
+  return NULL;
+}
+
+#define BITS_WORDS(n) (((n) + 63) / 64)
+
+static int bit_test(const uint64_t *map, int i){
+  return (__atomic_load_n(&map[i/64], __ATOMIC_RELAXED) >> (i%64)) & 1;
+}
+
+/* The bit is tested first: most updates leave it unchanged, and a
+ * plain load is much cheaper than a locked read-modify-write. */
+static void bit_set(uint64_t *map, int i){
+  if (!bit_test(map, i))
+    __atomic_fetch_or(&map[i/64], 1ull << (i%64), __ATOMIC_RELAXED);
+}
+
+static void bit_clear(uint64_t *map, int i){
+  if (bit_test(map, i))
+    __atomic_fetch_and(&map[i/64], ~(1ull << (i%64)), __ATOMIC_RELAXED);
+}
+
+static void bit_assign(uint64_t *map, int i, int value){
+  if (value)
+    bit_set(map, i);
+  else
+    bit_clear(map, i);
+}
+
+static int bit_test_clear(uint64_t *map, int i){
+  uint64_t old = __atomic_fetch_and(&map[i/64], ~(1ull << (i%64)), __ATOMIC_RELAXED);
+  return (old >> (i%64)) & 1;
+}
+
+static pid_t frame_owner(int frame){
+  return __atomic_load_n(&my_pager.frame_pid[frame], __ATOMIC_ACQUIRE);
+}
+
+static void frame_set_owner(int frame, pid_t pid){
+  bit_assign(my_pager.resident_bits, frame, pid != -1);
+  __atomic_store_n(&my_pager.frame_pid[frame], pid, __ATOMIC_RELEASE);
+}
+
+/* Adds `n` to the frames `proc` owns.  Called with the process lock
+ * held; `frame_get` reads the count without it. */
+static void proc_rss_add(struct proc *proc, int n){
+  int rss = __atomic_add_fetch(&proc->rss, n, __ATOMIC_RELAXED);
+  if (rss > proc->rss_peak)
+    proc->rss_peak = rss;
+}
+
+static int proc_at_quota(struct proc *proc){
+  int max = __atomic_load_n(&proc->rss_max, __ATOMIC_RELAXED);
+  return max > 0 && __atomic_load_n(&proc->rss, __ATOMIC_RELAXED) >= max;
+}
+
+/* Pops the lowest-numbered free frame, or returns -1. */
+static int frame_pop(void){
+  int frame = -1;
+  pthread_mutex_lock(&my_pager.frames_lock);
+  if (my_pager.frames_free>0){
+    my_pager.frames_free--;
+    frame = my_pager.free_frames_stack[my_pager.frames_free];
+  }
+  if (my_pager.frames_free < my_config.lowmark)
+    pthread_cond_signal(&my_pager.kswapd_cond);
+  pthread_mutex_unlock(&my_pager.frames_lock);
+  return frame;
+}
+
+static void frame_push(int frame){
+  frame_set_owner(frame, -1);
+  pthread_mutex_lock(&my_pager.frames_lock);
+  my_pager.free_frames_stack[my_pager.frames_free] = frame;
+  my_pager.frames_free++;
+  pthread_mutex_unlock(&my_pager.frames_lock);
+}
+
+/* Returns the number of blocks in swap cluster `cluster`; the last
+ * one may be short. */
+static int cluster_len(int cluster){
+  int first = cluster * my_config.swapcluster;
+  int n = my_pager.nblocks - first;
+  return n < my_config.swapcluster ? n : my_config.swapcluster;
+}
+
+/* Marks free `block` as used.  Called with `blocks_lock` held. */
+static void cluster_claim(int block){
+  bit_clear(my_pager.block_free_bits, block);
+  my_pager.cluster_free[block / my_config.swapcluster]--;
+}
+
+/* Returns a free block for `proc`: the next free one in its cluster,
+ * else the first block of a wholly free cluster, which becomes its
+ * cluster, else the lowest free block.  Called with `blocks_lock`
+ * held and at least one block free. */
+static int cluster_take(struct proc *proc){
+  while (proc->swap_next < proc->swap_end){
+    int block = proc->swap_next++;
+    if (bit_test(my_pager.block_free_bits, block)){
+      cluster_claim(block);
+      return block;
+    }
+  }
+  int block = -1;
+  for (int c = 0; c < my_pager.nclusters && block == -1; c++)
+    if (my_pager.cluster_free[c] == cluster_len(c))
+      block = c * my_config.swapcluster;
+  if (block != -1){
+    STAT_INC(cluster_allocs);
+  } else {
+    /* fragmented: carry on after the lowest free block */
+    for (int w = 0; block == -1; w++)
+      if (my_pager.block_free_bits[w])
+        block = w*64 + __builtin_ctzll(my_pager.block_free_bits[w]);
+  }
+  int cluster = block / my_config.swapcluster;
+  proc->swap_next = block + 1;
+  proc->swap_end = cluster * my_config.swapcluster + cluster_len(cluster);
+  cluster_claim(block);
+  return block;
+}
+
+/* Takes a free block for `proc`.  Called with `blocks_lock` held and
+ * at least one block free. */
+static int block_take(struct proc *proc){
+  int block;
+  if (my_config.swapcluster > 0)
+    block = cluster_take(proc);
+  else
+    block = my_pager.blocks_free_stack[my_pager.blocks_free-1];
+  my_pager.blocks_free--;
+  my_pager.block2pid[block] = proc->pid;
+  return block;
+}
+
+static int block_pop(struct proc *proc){
+  int block = -1;
+  pthread_mutex_lock(&my_pager.blocks_lock);
+  if (my_pager.blocks_free>0)
+    block = block_take(proc);
+  pthread_mutex_unlock(&my_pager.blocks_lock);
+  return block;
+}
+
+static void block_push(int block){
+  pthread_mutex_lock(&my_pager.blocks_lock);
+  my_pager.block2pid[block] = -1;
+  if (my_config.swapcluster > 0){
+    bit_set(my_pager.block_free_bits, block);
+    my_pager.cluster_free[block / my_config.swapcluster]++;
+  } else {
+    my_pager.blocks_free_stack[my_pager.blocks_free] = block;
+  }
+  my_pager.blocks_free++;
+  pthread_mutex_unlock(&my_pager.blocks_lock);
+}
+
+/* Reserves backing store for `n` new pages of `proc`: a block each,
+ * or with `lazyswap` room under the commit limit, setting the blocks
+ * to -1.  All `n` pages get it or none does; returns 0 if there is no
+ * room. */
+static int page_reserve(struct proc *proc, int *blocks, int n){
+  pthread_mutex_lock(&my_pager.blocks_lock);
+  int ok;
+  if (my_config.lazyswap){
+    ok = my_pager.committed + n <= my_pager.commit_limit;
+    if (ok)
+      my_pager.committed += n;
+    for (int i = 0; i < n; i++)
+      blocks[i] = -1;
+  } else {
+    ok = my_pager.blocks_free >= n;
+    for (int i = 0; ok && i < n; i++)
+      blocks[i] = block_take(proc);
+  }
+  pthread_mutex_unlock(&my_pager.blocks_lock);
+  return ok;
+}
 
+void pager_init(int nframes, int nblocks){
   my_pager.nframes = nframes;
-  my_pager.frames = malloc(sizeof(struct frame_data)*nframes);
+  my_pager.frame_pid = malloc(sizeof(pid_t)*nframes);
+  my_pager.frame_page = malloc(sizeof(int32_t)*nframes);
+  my_pager.frame_prot = malloc(sizeof(uint8_t)*nframes);
+  my_pager.ref_bits = calloc(BITS_WORDS(nframes), sizeof(uint64_t));
+  my_pager.dirty_bits = calloc(BITS_WORDS(nframes), sizeof(uint64_t));
+  my_pager.resident_bits = calloc(BITS_WORDS(nframes), sizeof(uint64_t));
   my_pager.frames_free = nframes;
   my_pager.free_frames_stack = malloc(sizeof(int)*nframes);
 
   int p = 0;
   for (int i = nframes-1; i >=0 ; i--){
     my_pager.free_frames_stack[p] = i;
+    my_pager.frame_pid[i] = -1;
     p++;
   }
 
@@ -83,210 +679,1744 @@ void pager_init(int nframes, int nblocks){
     my_pager.blocks_free_stack[p] = i;
     p++;
   }
+  if (my_config.swapcluster > 0){
+    my_pager.nclusters = (nblocks + my_config.swapcluster - 1) / my_config.swapcluster;
+    my_pager.cluster_free = malloc(sizeof(int)*my_pager.nclusters);
+    for (int c = 0; c < my_pager.nclusters; c++)
+      my_pager.cluster_free[c] = cluster_len(c);
+    my_pager.block_free_bits = calloc(BITS_WORDS(nblocks), sizeof(uint64_t));
+    for (int i = 0; i < nblocks; i++)
+      bit_set(my_pager.block_free_bits, i);
+  }
+
+  my_pager.naged = 0;
+  if (my_config.protvec)
+    my_pager.aged = malloc(sizeof(struct aged_page)*nframes);
 
   my_pager.n_procs = 0;
   my_pager.block2pid = malloc(nblocks*sizeof(pid_t));
-  my_pager.pid2proc = malloc(sizeof(struct proc));
+  proc_table_init(&my_pager.pid2proc, PROC_TABLE_MINSIZE);
+
+  if (my_pager.policy == NULL)
+    my_pager.policy = policy_find("clock");
+  my_pager.policy->init(nframes);
+  memset(&my_pager.stats, 0, sizeof(my_pager.stats));
+  my_pager.free_procs = NULL;
+
+  /* the zero frame is taken off the free stack for good; its owner
+   * stays -1 so the policies never pick it */
+  my_pager.zero_frame = -1;
+  if (my_config.zeroframe && nframes > 1){
+    my_pager.zero_frame = frame_pop();
+    mmu_zero_fill(my_pager.zero_frame);
+  }
 
-  my_pager.second_chance_idx = 0;
+  if (my_config.zswap > 0)
+    mmu_zswap_init(my_config.zswap);
 
-  pthread_mutex_unlock(&my_pager.mutex);
+  my_pager.committed = 0;
+  if (my_config.lazyswap){
+    int usable = my_pager.zero_frame != -1 ? nframes - 1 : nframes;
+    int percent = my_config.overcommit > 0 ? my_config.overcommit : 100;
+    my_pager.commit_limit = (long)(usable + nblocks - 1) * percent / 100;
+  }
+
+  if (my_config.lowmark > 0)
+    kswapd_start();
+  if (my_config.writeback > 0)
+    writeback_start();
+  if (my_config.ksm > 0)
+    ksm_start();
+  if (my_config.loadctl > 0)
+    loadctl_start();
+}
+
+int pager_option(const char *name, const char *value){
+  if (strcmp(name, "policy") == 0){
+    const struct policy *policy = policy_find(value);
+    if (policy == NULL)
+      return -1;
+    my_pager.policy = policy;
+    return 0;
+  }
+  for (int i = 0; i < sizeof(pager_int_options)/sizeof(pager_int_options[0]); i++){
+    if (strcmp(name, pager_int_options[i].name) == 0){
+      char *end;
+      long v = strtol(value, &end, 10);
+      if (*value == '\0' || *end != '\0' || v < 0 || v > INT32_MAX)
+        return -1;
+      *pager_int_options[i].value = (int)v;
+      return 0;
+    }
+  }
+  return policy_option(name, value);
+}
+
+void pager_report(void){
+  struct pager_stats *st = &my_pager.stats;
+  logd(LOG_INFO, "pager policy %s frames %d blocks %d\n",
+      my_pager.policy->name, my_pager.nframes, my_pager.nblocks);
+  logd(LOG_INFO, "pager faults %ld minor %ld zero_fills %ld\n",
+      st->faults, st->minor_faults, st->zero_fills);
+  logd(LOG_INFO, "pager disk_reads %ld disk_writes %ld evictions %ld\n",
+      st->disk_reads, st->disk_writes, st->evictions);
+  logd(LOG_INFO, "pager direct_reclaims %ld background_reclaims %ld kswapd_wakeups %ld\n",
+      st->direct_reclaims, st->background_reclaims, st->kswapd_wakeups);
+  logd(LOG_INFO, "pager clean_evictions %ld dirty_evictions %ld writeback_scans %ld writeback_pages %ld\n",
+      st->clean_evictions, st->dirty_evictions, st->writeback_scans, st->writeback_pages);
+  logd(LOG_INFO, "pager readahead_pages %ld readahead_hits %ld readahead_misses %ld\n",
+      st->readahead_pages, st->readahead_hits, st->readahead_misses);
+  logd(LOG_INFO, "pager write_faults %ld zero_maps %ld zero_cows %ld\n",
+      st->write_faults, st->zero_maps, st->zero_cows);
+  logd(LOG_INFO, "pager zswap_stores %ld zswap_rejects %ld zswap_loads %ld\n",
+      st->zswap_stores, st->zswap_rejects, st->zswap_loads);
+  if (my_config.lazyswap)
+    logd(LOG_INFO, "pager commit_limit %ld block_shortages %ld blocks_reclaimed %ld oom_kills %ld\n",
+        my_pager.commit_limit, st->block_shortages, st->blocks_reclaimed, st->oom_kills);
+  logd(LOG_INFO, "pager local_evictions %ld reserve_skips %ld\n",
+      st->local_evictions, st->reserve_skips);
+  logd(LOG_INFO, "pager released_pages %ld released_frames %ld\n",
+      st->released_pages, st->released_frames);
+  if (my_config.swapcluster > 0)
+    logd(LOG_INFO, "pager swapcluster allocs %ld writes %ld write_pages %ld reads %ld read_pages %ld\n",
+        st->cluster_allocs, st->cluster_writes, st->cluster_write_pages,
+        st->cluster_reads, st->cluster_read_pages);
+  if (my_config.protvec)
+    logd(LOG_INFO, "pager protvec msgs %ld pages %ld\n",
+        st->protvec_msgs, st->protvec_pages);
+  if (my_config.loadctl > 0)
+    logd(LOG_INFO, "pager loadctl periods %ld thrashing %ld suspends %ld resumes %ld deferred %ld swapped %ld\n",
+        st->loadctl_periods, st->loadctl_thrashing, st->loadctl_suspends,
+        st->loadctl_resumes, st->loadctl_deferred, st->loadctl_swapped);
+  if (my_pager.ksm_mappers == NULL)
+    return;
+  logd(LOG_INFO, "pager ksm_scans %ld scan_cpu_us %ld merges %ld cows %ld reuses %ld\n",
+      st->ksm_scans, st->ksm_scan_ns / 1000, st->ksm_merges, st->ksm_cows, st->ksm_reuses);
+  logd(LOG_INFO, "pager ksm frames_saved %d max %d writes_saved %ld\n",
+      my_pager.ksm_saved, my_pager.ksm_saved_max, st->ksm_writes_saved);
 }
 
 void pager_create(pid_t pid){
-  pthread_mutex_lock(&my_pager.mutex);
+  pthread_rwlock_wrlock(&my_pager.table_lock);
 
+  struct proc *proc = proc_alloc();
+  proc->pid = pid;
+  proc_table_insert(&my_pager.pid2proc, proc);
   my_pager.n_procs++;
-  my_pager.pid2proc = realloc(my_pager.pid2proc, my_pager.n_procs*sizeof(struct proc));
-  my_pager.pid2proc[my_pager.n_procs-1].pid = pid;
-  my_pager.pid2proc[my_pager.n_procs-1].npages = 0;
-  my_pager.pid2proc[my_pager.n_procs-1].maxpages = addr_to_page((void *)UVM_MAXADDR);
 
-  pthread_mutex_unlock(&my_pager.mutex);
+  pthread_rwlock_unlock(&my_pager.table_lock);
 }
 
 
+int pager_set_quota(pid_t pid, int min, int max){
+  if (min < 0 || max < 0 || (max > 0 && min > max) || min >= my_pager.nframes)
+    return -1;
+  struct proc *proc = proc_get(pid);
+  if (proc == NULL)
+    return -1;
+  pthread_mutex_lock(&proc->lock);
+  proc->rss_min = min;
+  __atomic_store_n(&proc->rss_max, max, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&proc->lock);
+  proc_put(proc);
+  return 0;
+}
+
 void *pager_extend(pid_t pid){
-  pthread_mutex_lock(&my_pager.mutex);
-
-  if (my_pager.blocks_free>0){
-    my_pager.blocks_free--;
-    my_pager.block2pid[my_pager.blocks_free_stack[my_pager.blocks_free]] = pid;
-
-    for (int i = 0; i < my_pager.n_procs; i++){
-      if (my_pager.pid2proc[i].pid == pid){
- 
-        if(my_pager.pid2proc[i].npages+1 > my_pager.pid2proc[i].maxpages){
-          pthread_mutex_unlock(&my_pager.mutex);
-          return NULL;
-        }
+  return pager_extend_range(pid, 1);
+}
+
+void *pager_extend_range(pid_t pid, int n){
+  if (n < 1)
+    return NULL;
+  struct proc *proc = proc_get(pid);
+  if (proc == NULL)
+    return NULL;
 
-        my_pager.pid2proc[i].npages++;
-        
-        if (my_pager.pid2proc[i].npages==1)
-          my_pager.pid2proc[i].pages = malloc(sizeof(struct page_data));
-        else
-          my_pager.pid2proc[i].pages = realloc(my_pager.pid2proc[i].pages, sizeof(struct page_data)*my_pager.pid2proc[i].npages);
-  
-        my_pager.pid2proc[i].pages[my_pager.pid2proc[i].npages-1].block = my_pager.blocks_free_stack[my_pager.blocks_free];
-        my_pager.pid2proc[i].pages[my_pager.pid2proc[i].npages-1].on_disk = 0;
-        my_pager.pid2proc[i].pages[my_pager.pid2proc[i].npages-1].frame = -1;
-
-        
-        pthread_mutex_unlock(&my_pager.mutex);
-        return page_to_addr(my_pager.pid2proc[i].npages -1);
+  void *vaddr = NULL;
+  pthread_mutex_lock(&proc->lock);
+  if (n <= proc->maxpages - proc->npages){
+    int blocks[n];
+    if (page_reserve(proc, blocks, n)){
+      int first = proc->npages;
+      for (int i = 0; i < n; i++){
+        proc->pages[first+i].block = blocks[i];
+        proc->pages[first+i].flags = 0;
+        proc->pages[first+i].frame = -1;
       }
+      proc->npages += n;
+      vaddr = page_to_addr(first);
     }
   }
+  pthread_mutex_unlock(&proc->lock);
 
-  pthread_mutex_unlock(&my_pager.mutex);
-	return NULL;
+  proc_put(proc);
+  return vaddr;
 }
 
-void second_chance(){
-  while (1){
-    my_pager.second_chance_idx %= my_pager.nframes;
-
-    if (my_pager.frames[my_pager.second_chance_idx].reference_bit==0){
-      for (int i = 0; i < my_pager.n_procs; i++){
-        if (my_pager.pid2proc[i].pid == my_pager.frames[my_pager.second_chance_idx].pid){
-          int frame_from = my_pager.pid2proc[i].pages[my_pager.frames[my_pager.second_chance_idx].page].frame;
-          int block_to = my_pager.pid2proc[i].pages[my_pager.frames[my_pager.second_chance_idx].page].block;
-          my_pager.pid2proc[i].pages[my_pager.frames[my_pager.second_chance_idx].page].frame = -1;
-          mmu_nonresident(my_pager.pid2proc[i].pid, page_to_addr(my_pager.frames[frame_from].page));
-          if(my_pager.frames[frame_from].dirty == 1){
-            my_pager.pid2proc[i].pages[my_pager.frames[my_pager.second_chance_idx].page].on_disk = 1;
-            mmu_disk_write(frame_from, block_to);
-          }  
-        }
+/* Takes `lock`, charging the wait to the fault being serviced, if
+ * any. */
+static void lock_timed(pthread_mutex_t *lock){
+  uint64_t start = hist_now();
+  pthread_mutex_lock(lock);
+  hist_fault_add(HIST_FAULT_LOCK, hist_now() - start);
+}
+
+/* Locks and returns the process owning `frame`, or NULL if the frame
+ * is free, being filled, or its owner is exiting.  On success the
+ * caller must `frame_unlock` the process. */
+static struct proc *frame_lock(int frame){
+  pid_t pid = frame_owner(frame);
+  if (pid < 0)
+    return NULL;
+  struct proc *proc = proc_get(pid);
+  if (proc == NULL)
+    return NULL;
+  lock_timed(&proc->lock);
+  int page = my_pager.frame_page[frame];
+  if (!proc->dead && frame_owner(frame) == pid && page_frame(&proc->pages[page]) == frame)
+    return proc;
+  pthread_mutex_unlock(&proc->lock);
+  proc_put(proc);
+  return NULL;
+}
+
+static void frame_unlock(struct proc *proc){
+  pthread_mutex_unlock(&proc->lock);
+  proc_put(proc);
+}
+
+/* Shared frames are mapped read-only and never fault on reads, so
+ * their reference bit is only set when a page is merged into them. */
+int pager_frame_test(int frame){
+  if (frame_owner(frame) == FRAME_KSM)
+    return bit_test(my_pager.ref_bits, frame);
+  struct proc *proc = frame_lock(frame);
+  if (proc == NULL)
+    return -1;
+  int ref = bit_test(my_pager.ref_bits, frame);
+  frame_unlock(proc);
+  return ref;
+}
+
+static int aged_cmp(const void *a, const void *b){
+  const struct aged_page *x = a, *y = b;
+  if (x->pid != y->pid)
+    return x->pid < y->pid ? -1 : 1;
+  return x->page - y->page;
+}
+
+static void aged_send(pid_t pid, void **vaddrs, int *prots, int n){
+  mmu_chprot_vec(pid, vaddrs, prots, n);
+  STAT_INC(protvec_msgs);
+  __atomic_add_fetch(&my_pager.stats.protvec_pages, n, __ATOMIC_RELAXED);
+}
+
+/* Revokes access to the pages queued by `pager_frame_age`, with one
+ * vectored change per process, in page order.  Pages that were
+ * referenced, evicted or already revoked since they were queued are
+ * skipped.  `frame_prot` is only lowered here, when the change is
+ * sent, so until then it still tells what the process may do, e.g.,
+ * that writeback must revoke write access first.  Called with
+ * `clock_lock` held and no process lock. */
+static void aged_flush(void){
+  struct aged_page *aged = my_pager.aged;
+  int naged = my_pager.naged;
+  if (naged == 0)
+    return;
+  my_pager.naged = 0;
+  qsort(aged, naged, sizeof(*aged), aged_cmp);
+  for (int i = 0, j; i < naged; i = j){
+    pid_t pid = aged[i].pid;
+    for (j = i + 1; j < naged && aged[j].pid == pid; j++)
+      ;
+    struct proc *proc = proc_get(pid);
+    if (proc == NULL)
+      continue;
+    void *vaddrs[MMU_VEC_MAX];
+    int prots[MMU_VEC_MAX];
+    int n = 0;
+    lock_timed(&proc->lock);
+    for (int k = i; k < j && !proc->dead; k++){
+      int page = aged[k].page, frame = aged[k].frame;
+      if (page >= proc->npages || page_frame(&proc->pages[page]) != frame
+          || frame_owner(frame) != pid || bit_test(my_pager.ref_bits, frame)
+          || my_pager.frame_prot[frame] == PROT_NONE)
+        continue;
+      my_pager.frame_prot[frame] = PROT_NONE;
+      vaddrs[n] = page_to_addr(page);
+      prots[n++] = PROT_NONE;
+      if (n == MMU_VEC_MAX){
+        aged_send(pid, vaddrs, prots, n);
+        n = 0;
       }
-      break;
-    } else{
-        my_pager.frames[my_pager.second_chance_idx].reference_bit = 0;
-        my_pager.frames[my_pager.second_chance_idx].prot = PROT_NONE;
-        mmu_chprot(my_pager.frames[my_pager.second_chance_idx].pid, page_to_addr(my_pager.frames[my_pager.second_chance_idx].page), PROT_NONE);
     }
-    my_pager.second_chance_idx++;
+    if (n > 0)
+      aged_send(pid, vaddrs, prots, n);
+    frame_unlock(proc);
   }
 }
 
-void pager_fault(pid_t pid, void *addr){
-  pthread_mutex_lock(&my_pager.mutex);
+/* With `protvec`, the revocation is queued and sent by `aged_flush`
+ * once the caller's sweep is over.  Called with `clock_lock` held. */
+int pager_frame_age(int frame){
+  if (frame_owner(frame) == FRAME_KSM)
+    return bit_test_clear(my_pager.ref_bits, frame);
+  struct proc *proc = frame_lock(frame);
+  if (proc == NULL)
+    return -1;
+  pid_t pid = proc->pid;
+  int page = my_pager.frame_page[frame];
+  int ref = bit_test_clear(my_pager.ref_bits, frame);
+  if (ref && !my_config.protvec){
+    my_pager.frame_prot[frame] = PROT_NONE;
+    mmu_chprot(pid, page_to_addr(page), PROT_NONE);
+  }
+  frame_unlock(proc);
+  if (ref && my_config.protvec){
+    if (my_pager.naged == my_pager.nframes)
+      aged_flush();
+    my_pager.aged[my_pager.naged++] = (struct aged_page){ pid, page, frame };
+  }
+  return ref;
+}
 
-  int page = addr_to_page(addr);
+int pager_frame_dirty(int frame){
+  if (frame_owner(frame) == FRAME_KSM)
+    return 0;
+  struct proc *proc = frame_lock(frame);
+  if (proc == NULL)
+    return -1;
+  int dirty = bit_test(my_pager.dirty_bits, frame);
+  frame_unlock(proc);
+  return dirty;
+}
 
-  for (int i = 0; i < my_pager.n_procs; i++){
-    if (my_pager.pid2proc[i].pid==pid){
-      if (page >= my_pager.pid2proc[i].npages || page < 0){
-        printf("Segmentation fault: address out of processes range");
-        exit(0);
+int pager_frame_scan(int from, int to){
+  for (int w = from/64; w < BITS_WORDS(to); w++){
+    uint64_t mask = ~0ull;
+    if (w == from/64)
+      mask &= ~0ull << (from%64);
+    if (w == to/64)
+      mask &= (1ull << (to%64)) - 1;
+    uint64_t resident = __atomic_load_n(&my_pager.resident_bits[w], __ATOMIC_RELAXED) & mask;
+    uint64_t ref = __atomic_load_n(&my_pager.ref_bits[w], __ATOMIC_RELAXED);
+    while (resident){
+      /* age the referenced frames up to the first unreferenced one */
+      uint64_t unref = resident & ~ref;
+      uint64_t below = unref ? (unref & -unref) - 1 : ~0ull;
+      for (uint64_t r = resident & below; r; r &= r - 1)
+        pager_frame_age(w*64 + __builtin_ctzll(r));
+      if (!unref)
+        break;
+      int frame = w*64 + __builtin_ctzll(unref);
+      if (pager_frame_age(frame) == 0)
+        return frame;
+      resident &= ~below << 1;
+    }
+  }
+  return -1;
+}
+
+/* Tells whether `page` of `proc` is resident in a dirty frame of its
+ * own, with its contents due in `block`.
+ * Called with the process lock held. */
+static int swapout_neighbour(struct proc *proc, int page, int block){
+  if (page < 0 || page >= proc->npages)
+    return 0;
+  struct page_data *pdata = &proc->pages[page];
+  int frame = page_frame(pdata);
+  return pdata->block == block && frame != -1 && !(pdata->flags & PAGE_KSM)
+    && frame_owner(frame) == proc->pid
+    && bit_test(my_pager.dirty_bits, frame);
+}
+
+/* Writes `frame`, just evicted from `page` of `proc`, to the page's
+ * block in one transfer with the dirty pages around it whose blocks
+ * continue the run, up to `swapcluster` pages in all.  The neighbours
+ * stay resident, clean and read-only, as after `writeback_frame`, so
+ * their own eviction needs no write.  Called with the process lock
+ * held. */
+static void swapout_cluster(struct proc *proc, int page, int frame){
+  int block = proc->pages[page].block;
+  int lo = page, hi = page;
+  while (hi - lo + 1 < my_config.swapcluster
+      && swapout_neighbour(proc, lo - 1, block - (page - lo) - 1))
+    lo--;
+  while (hi - lo + 1 < my_config.swapcluster
+      && swapout_neighbour(proc, hi + 1, block + (hi - page) + 1))
+    hi++;
+  int n = hi - lo + 1;
+  int frames[n];
+  for (int q = lo; q <= hi; q++){
+    if (q == page){
+      frames[q-lo] = frame;
+      continue;
+    }
+    int f = proc->pages[q].frame;
+    if (my_pager.frame_prot[f] & PROT_WRITE){
+      my_pager.frame_prot[f] = PROT_READ;
+      mmu_chprot(proc->pid, page_to_addr(q), PROT_READ);
+    }
+    bit_clear(my_pager.dirty_bits, f);
+    proc->pages[q].flags |= PAGE_ON_DISK;
+    frames[q-lo] = f;
+  }
+  mmu_sync(proc->pid);
+  if (n == 1){
+    mmu_disk_write(frame, block);
+  } else {
+    mmu_disk_write_vec(frames, block - (page - lo), n);
+    STAT_INC(cluster_writes);
+    __atomic_add_fetch(&my_pager.stats.cluster_write_pages, n - 1, __ATOMIC_RELAXED);
+  }
+  __atomic_add_fetch(&my_pager.stats.disk_writes, n, __ATOMIC_RELAXED);
+}
+
+/* Pages out the page in `frame` if it is still unreferenced, writing
+ * it to its block if dirty.  Returns 1 if the frame was evicted.  If
+ * a dirty page has no block and none is free, the frame is not evicted
+ * and `block_shortage` is set.  With `protect` set, frames of processes
+ * within their `rss_min` are not evicted either, and `reserve_skip` is
+ * set.  Called with `clock_lock` held. */
+static int frame_evict(int frame, int protect){
+  if (frame_owner(frame) == FRAME_KSM)
+    return ksm_evict(frame);
+  struct proc *proc = frame_lock(frame);
+  if (proc == NULL)
+    return 0;
+  if (bit_test(my_pager.ref_bits, frame)){
+    frame_unlock(proc);
+    return 0;
+  }
+  if (protect && proc->rss <= proc->rss_min){
+    my_pager.reserve_skip = 1;
+    frame_unlock(proc);
+    return 0;
+  }
+  pid_t pid = proc->pid;
+  int page = my_pager.frame_page[frame];
+  int dirty = bit_test(my_pager.dirty_bits, frame);
+  struct page_data *victim = &proc->pages[page];
+  int new_block = 0;
+  if (dirty && victim->block == -1){
+    victim->block = block_pop(proc);
+    new_block = victim->block != -1;
+    if (!new_block && my_config.zswap == 0){
+      my_pager.block_shortage = 1;
+      STAT_INC(block_shortages);
+      frame_unlock(proc);
+      return 0;
+    }
+  }
+  if (victim->flags & PAGE_PREFETCHED){
+    victim->flags &= ~PAGE_PREFETCHED;
+    proc->ra_window /= 2;
+    STAT_INC(readahead_misses);
+  }
+  victim->frame = -1;
+  frame_set_owner(frame, -1);
+  proc_rss_add(proc, -1);
+  mmu_nonresident(pid, page_to_addr(page));
+  /* the page must be unmapped before its frame is copied or reused */
+  mmu_sync(pid);
+  if(dirty){
+    int handle = my_config.zswap > 0 ? mmu_zswap_store(frame) : -1;
+    if (handle != -1){
+      /* the block is stale until the page is written out again */
+      victim->flags &= ~PAGE_ON_DISK;
+      victim->flags |= PAGE_ZSWAP;
+      victim->frame = handle;
+      if (new_block){
+        block_push(victim->block);
+        victim->block = -1;
+      }
+      STAT_INC(zswap_stores);
+    } else if (victim->block == -1){
+      /* nowhere to put it: map the page back */
+      victim->frame = frame;
+      frame_set_owner(frame, pid);
+      proc_rss_add(proc, 1);
+      mmu_resident(pid, page_to_addr(page), frame, my_pager.frame_prot[frame]);
+      my_pager.block_shortage = 1;
+      STAT_INC(zswap_rejects);
+      STAT_INC(block_shortages);
+      frame_unlock(proc);
+      return 0;
+    } else {
+      if (my_config.zswap > 0)
+        STAT_INC(zswap_rejects);
+      victim->flags |= PAGE_ON_DISK;
+      if (my_config.swapcluster > 0){
+        swapout_cluster(proc, page, frame);
+      } else {
+        mmu_disk_write(frame, victim->block);
+        STAT_INC(disk_writes);
       }
+    }
+    STAT_INC(dirty_evictions);
+  } else {
+    STAT_INC(clean_evictions);
+  }
+  frame_unlock(proc);
+  STAT_INC(evictions);
+  if (my_pager.policy->on_evict)
+    my_pager.policy->on_evict(frame, pid, page);
+  return 1;
+}
 
-      int frame = my_pager.pid2proc[i].pages[page].frame;
-      if(frame == -1){
-        if (my_pager.frames_free>0){
-          my_pager.frames_free--;
-          frame = my_pager.free_frames_stack[my_pager.frames_free];
-        } else {
-          second_chance();
-          my_pager.pid2proc[i].pages[page].frame = my_pager.second_chance_idx;
-          frame = my_pager.second_chance_idx;
-          my_pager.second_chance_idx++;
-        }
+/* Frees up to BLOCKS_RECLAIM blocks of pages whose contents are also
+ * elsewhere, for when lazily allocated blocks run out: pages in the
+ * zswap pool, and resident pages, whose frame becomes dirty as it is
+ * now the only copy.  Pages in shared frames keep their blocks.
+ * Returns the number of blocks freed.  Called with `clock_lock` held
+ * and no process lock. */
+#define BLOCKS_RECLAIM 32
 
-        my_pager.frames[frame].pid = pid;
-        my_pager.pid2proc[i].pages[page].frame = frame;
-        my_pager.frames[frame].page = page;
-        my_pager.frames[frame].reference_bit = 1;
+static int blocks_reclaim(void){
+  int freed = 0;
+  pthread_rwlock_rdlock(&my_pager.table_lock);
+  struct proc_table *t = &my_pager.pid2proc;
+  for (int i = 0; i < t->size && freed < BLOCKS_RECLAIM; i++){
+    struct proc *proc = t->slots[i];
+    if (proc == NULL || proc == PROC_DEAD)
+      continue;
+    pthread_mutex_lock(&proc->lock);
+    for (int page = 0; page < proc->npages && freed < BLOCKS_RECLAIM; page++){
+      struct page_data *pdata = &proc->pages[page];
+      if (pdata->block == -1 || (pdata->flags & PAGE_KSM))
+        continue;
+      int frame = page_frame(pdata);
+      if (frame == -1 && !(pdata->flags & PAGE_ZSWAP))
+        continue;
+      if (frame != -1)
+        bit_set(my_pager.dirty_bits, frame);
+      block_push(pdata->block);
+      pdata->block = -1;
+      pdata->flags &= ~PAGE_ON_DISK;
+      freed++;
+    }
+    pthread_mutex_unlock(&proc->lock);
+  }
+  pthread_rwlock_unlock(&my_pager.table_lock);
+  __atomic_add_fetch(&my_pager.stats.blocks_reclaimed, freed, __ATOMIC_RELAXED);
+  return freed;
+}
 
-        if(my_pager.pid2proc[i].pages[page].on_disk){
-          int block = my_pager.pid2proc[i].pages[page].block;
-          my_pager.pid2proc[i].pages[page].on_disk = 0;
-          mmu_disk_read(block, frame);
-        } else {
-          mmu_zero_fill(frame);
-        }
+/* Pages out one of the frames of `proc`, chosen by a clock over its
+ * page table, and returns it; -1 if none could be evicted.  Called
+ * with `clock_lock` held and no process lock. */
+static int frame_evict_local(struct proc *proc){
+  pthread_mutex_lock(&proc->lock);
+  int npages = proc->npages;
+  pthread_mutex_unlock(&proc->lock);
+  for (int n = 0; n < 2*npages; n++){
+    pthread_mutex_lock(&proc->lock);
+    int page = proc->rss_hand < proc->npages ? proc->rss_hand : 0;
+    proc->rss_hand = page + 1;
+    int frame = page_frame(&proc->pages[page]);
+    if (frame != -1 && frame_owner(frame) != proc->pid)
+      frame = -1;
+    pthread_mutex_unlock(&proc->lock);
+    if (frame == -1 || pager_frame_age(frame) != 0)
+      continue;
+    if (frame_evict(frame, 0)){
+      __atomic_add_fetch(&proc->local_evictions, 1, __ATOMIC_RELAXED);
+      STAT_INC(local_evictions);
+      return frame;
+    }
+  }
+  return -1;
+}
+
+/* Returns a frame that no page maps and that is not on the free
+ * stack, preferring free frames and paging out a victim chosen by
+ * the replacement policy otherwise.  A process at its `rss_max`
+ * replaces its own pages instead.  If `may_evict` is zero, returns
+ * -1 instead of paging out; it also returns -1 if memory is exhausted,
+ * i.e., no victim can be written out and no block can be reclaimed.
+ * Called without any process lock held; the policy learns `page` of
+ * `proc` will be loaded into the frame. */
+#define OOM_RETRIES 100
+
+static int frame_get(struct proc *proc, int page, int may_evict){
+  int local = proc_at_quota(proc);
+  if (local && !may_evict)
+    return -1;
+  int frame = local ? -1 : frame_pop();
+  if (frame != -1 && my_pager.policy->on_fault == NULL)
+    return frame;
+  if (frame == -1 && !may_evict)
+    return -1;
+
+  /* with writeback running, pass over dirty victims for up to one
+   * sweep so clean frames are dropped first */
+  int skips = my_config.writeback > 0 ? my_pager.nframes : 0;
+  int stuck = 0;
+  /* reserves are honored until a whole sweep found nothing else */
+  int protect = 1, reserved = 0;
+
+  lock_timed(&my_pager.clock_lock);
+  if (local)
+    frame = frame_evict_local(proc);
+  while (frame == -1){
+    frame = frame_pop();
+    if (frame != -1)
+      break;
+    uint64_t start = hist_now();
+    int victim = my_pager.policy->select_victim();
+    aged_flush();
+    hist_fault_add(HIST_FAULT_SELECT, hist_now() - start);
+    if (victim != -1 && skips > 0 && pager_frame_dirty(victim) == 1){
+      skips--;
+      continue;
+    }
+    if (victim != -1 && frame_evict(victim, protect)){
+      frame = victim;
+      STAT_INC(direct_reclaims);
+    } else if (my_pager.reserve_skip){
+      my_pager.reserve_skip = 0;
+      STAT_INC(reserve_skips);
+      if (++reserved >= my_pager.nframes)
+        protect = 0;
+    } else if (my_pager.block_shortage){
+      my_pager.block_shortage = 0;
+      if (blocks_reclaim() > 0){
+        stuck = 0;
+        continue;
+      }
+      if (++stuck > OOM_RETRIES*my_pager.nframes)
+        break;
+      if (stuck % my_pager.nframes == 0){
+        /* pages being loaded by other faults free blocks once resident */
+        pthread_mutex_unlock(&my_pager.clock_lock);
+        usleep(1000);
+        lock_timed(&my_pager.clock_lock);
+      }
+    } else if (victim == -1){
+      /* every frame is in flight: let those faults finish */
+      pthread_mutex_unlock(&my_pager.clock_lock);
+      sched_yield();
+      lock_timed(&my_pager.clock_lock);
+    }
+  }
+  if (frame != -1 && my_pager.policy->on_fault)
+    my_pager.policy->on_fault(frame, proc->pid, page);
+  aged_flush();
+  pthread_mutex_unlock(&my_pager.clock_lock);
+  return frame;
+}
+
+/* Background pageout thread.  Sleeps until fewer than `lowmark`
+ * frames are free, then evicts frames chosen by the policy onto the
+ * free stack until `highmark` frames are free, so faults can usually
+ * pop a free frame instead of reclaiming one themselves. */
+static void *kswapd(void *arg){
+  while (1){
+    pthread_mutex_lock(&my_pager.frames_lock);
+    while (my_pager.frames_free >= my_config.lowmark)
+      pthread_cond_wait(&my_pager.kswapd_cond, &my_pager.frames_lock);
+    pthread_mutex_unlock(&my_pager.frames_lock);
+    STAT_INC(kswapd_wakeups);
 
-        mmu_resident(pid, page_to_addr(page), frame, PROT_READ);
-        my_pager.frames[frame].prot = PROT_READ;
-        my_pager.frames[frame].dirty = 0;
-      } else{
-          my_pager.frames[frame].reference_bit = 1;
+    int failures = 0;
+    while (__atomic_load_n(&my_pager.frames_free, __ATOMIC_RELAXED) < my_config.highmark){
+      pthread_mutex_lock(&my_pager.clock_lock);
+      int victim = my_pager.policy->select_victim();
+      aged_flush();
+      int evicted = victim != -1 && frame_evict(victim, 1);
+      if (!evicted && my_pager.block_shortage){
+        my_pager.block_shortage = 0;
+        blocks_reclaim();
+      }
+      pthread_mutex_unlock(&my_pager.clock_lock);
+      if (evicted){
+        frame_push(victim);
+        STAT_INC(background_reclaims);
+        failures = 0;
+      } else if (++failures == 2){
+        /* nothing evictable right now, let faults make progress */
+        usleep(1000);
+        failures = 0;
+      }
+    }
+  }
+  return NULL;
+}
+
+static void kswapd_start(void){
+  if (my_config.highmark <= my_config.lowmark)
+    my_config.highmark = 2*my_config.lowmark;
+  if (my_config.highmark > my_pager.nframes-1)
+    my_config.highmark = my_pager.nframes-1;
+  if (my_config.lowmark > my_config.highmark)
+    my_config.lowmark = my_config.highmark;
+  if (my_config.lowmark == 0)
+    return;
+  pthread_t thread;
+  pthread_create(&thread, NULL, kswapd, NULL);
+  pthread_detach(thread);
+}
 
-         if (my_pager.frames[frame].prot==PROT_NONE){
-          my_pager.frames[frame].prot = PROT_READ;
-          mmu_chprot(pid, page_to_addr(page), PROT_READ);
+/* Writes `frame` to its block if it is dirty and was not referenced
+ * since the clock last passed it.  Write access is revoked before the
+ * copy, so later writes fault and mark the frame dirty again. */
+static void writeback_frame(int frame){
+  struct proc *proc = frame_lock(frame);
+  if (proc == NULL)
+    return;
+  int page = my_pager.frame_page[frame];
+  struct page_data *pdata = &proc->pages[page];
+  int candidate = bit_test(my_pager.dirty_bits, frame) && !bit_test(my_pager.ref_bits, frame);
+  if (candidate && pdata->block == -1)
+    pdata->block = block_pop(proc);
+  if (candidate && pdata->block != -1){
+    if (my_pager.frame_prot[frame] & PROT_WRITE){
+      my_pager.frame_prot[frame] = PROT_READ;
+      mmu_chprot(proc->pid, page_to_addr(page), PROT_READ);
+    }
+    mmu_sync(proc->pid);
+    mmu_disk_write(frame, pdata->block);
+    pdata->flags |= PAGE_ON_DISK;
+    bit_clear(my_pager.dirty_bits, frame);
+    STAT_INC(disk_writes);
+    STAT_INC(writeback_pages);
+  }
+  frame_unlock(proc);
+}
+
+/* Writeback thread.  Every `writeback` milliseconds it cleans dirty
+ * frames that are not recently referenced, so evictions can usually
+ * drop clean frames without writing to disk. */
+static void *writeback(void *arg){
+  while (1){
+    usleep(my_config.writeback * 1000);
+    STAT_INC(writeback_scans);
+    for (int frame = 0; frame < my_pager.nframes; frame++)
+      writeback_frame(frame);
+  }
+  return NULL;
+}
+
+static void writeback_start(void){
+  pthread_t thread;
+  pthread_create(&thread, NULL, writeback, NULL);
+  pthread_detach(thread);
+}
+
+/* Load control.  Every `loadctl` milliseconds the controller estimates
+ * each process's working set as the pages that faulted in the period;
+ * the clock revokes access to pages it ages, so pages in use keep
+ * faulting.  The system is thrashing when the working sets of the
+ * active processes do not fit in memory and most faults are major,
+ * i.e., processes wait on page-ins rather than run.  Then the active
+ * process that has run longest is suspended: its faults are deferred
+ * (see `loadctl_defer`) and its frames are paged out at once.  Suspended
+ * processes resume, longest suspended first, when their working set
+ * fits next to the active ones, or after LOADCTL_MAX_PERIODS so that
+ * processes take turns.  At least one process always stays active. */
+#define LOADCTL_MAX_PERIODS 20
+
+/* Returns 1 if `proc` is suspended, in which case its fault is not
+ * serviced: the MMU holds the request until `mmu_resume` is called for
+ * the process, so a suspended process never holds up an MMU worker.
+ * Called without any lock held. */
+static int loadctl_defer(struct proc *proc){
+  pthread_mutex_lock(&my_pager.loadctl_lock);
+  int suspended = proc->suspended;
+  if (suspended){
+    proc->deferred = 1;
+    STAT_INC(loadctl_deferred);
+  }
+  pthread_mutex_unlock(&my_pager.loadctl_lock);
+  return suspended;
+}
+
+static void loadctl_set(struct proc *proc, int suspended){
+  pthread_mutex_lock(&my_pager.loadctl_lock);
+  proc->suspended = suspended;
+  proc->active_since = my_pager.loadctl_period;
+  int deferred = !suspended && proc->deferred;
+  if (deferred)
+    proc->deferred = 0;
+  pthread_mutex_unlock(&my_pager.loadctl_lock);
+  if (deferred)
+    mmu_resume(proc->pid);
+}
+
+/* Pages out every frame `proc` owns. */
+static void loadctl_swap_out(struct proc *proc){
+  pthread_mutex_lock(&my_pager.clock_lock);
+  pthread_mutex_lock(&proc->lock);
+  int npages = proc->npages;
+  pthread_mutex_unlock(&proc->lock);
+  for (int page = 0; page < npages; page++){
+    pthread_mutex_lock(&proc->lock);
+    int frame = page_frame(&proc->pages[page]);
+    if (frame != -1 && frame_owner(frame) != proc->pid)
+      frame = -1;
+    pthread_mutex_unlock(&proc->lock);
+    if (frame == -1)
+      continue;
+    bit_clear(my_pager.ref_bits, frame);
+    if (frame_evict(frame, 0)){
+      frame_push(frame);
+      STAT_INC(loadctl_swapped);
+    }
+  }
+  pthread_mutex_unlock(&my_pager.clock_lock);
+}
+
+/* Returns the live processes, each with a reference taken, and their
+ * number in `n`. */
+static struct proc **loadctl_procs(int *n){
+  pthread_rwlock_rdlock(&my_pager.table_lock);
+  struct proc_table *t = &my_pager.pid2proc;
+  struct proc **procs = malloc((t->used + 1) * sizeof(struct proc *));
+  *n = 0;
+  for (int i = 0; i < t->size; i++){
+    struct proc *proc = t->slots[i];
+    if (proc == NULL || proc == PROC_DEAD)
+      continue;
+    __atomic_add_fetch(&proc->refcnt, 1, __ATOMIC_ACQ_REL);
+    procs[(*n)++] = proc;
+  }
+  pthread_rwlock_unlock(&my_pager.table_lock);
+  return procs;
+}
+
+static void loadctl_check(void){
+  int n;
+  struct proc **procs = loadctl_procs(&n);
+  int usable = my_pager.zero_frame != -1 ? my_pager.nframes - 1 : my_pager.nframes;
+  long period = ++my_pager.loadctl_period;
+  int active = 0, active_ws = 0;
+  long faults = 0, major = 0;
+  for (int i = 0; i < n; i++){
+    struct proc *proc = procs[i];
+    pthread_mutex_lock(&proc->lock);
+    if (!proc->suspended){
+      int ws = 0;
+      for (int w = 0; w < PROC_WS_WORDS; w++)
+        ws += __builtin_popcountll(proc->ws_bits[w]);
+      proc->ws = ws;
+      active++;
+      active_ws += ws;
+      faults += proc->faults - proc->ws_faults;
+      major += proc->major_faults - proc->ws_major_faults;
+    }
+    memset(proc->ws_bits, 0, sizeof(proc->ws_bits));
+    proc->ws_faults = proc->faults;
+    proc->ws_major_faults = proc->major_faults;
+    pthread_mutex_unlock(&proc->lock);
+  }
+  STAT_INC(loadctl_periods);
+
+  int thrashing = active_ws > usable && 2*major > faults;
+  if (thrashing)
+    STAT_INC(loadctl_thrashing);
+  struct proc *victim = NULL, *resume = NULL;
+  for (int i = 0; i < n; i++){
+    struct proc *proc = procs[i];
+    if (proc->dead)
+      continue;
+    if (!proc->suspended && (victim == NULL || proc->active_since < victim->active_since))
+      victim = proc;
+    if (proc->suspended && (resume == NULL || proc->active_since < resume->active_since))
+      resume = proc;
+  }
+  if (thrashing && active > 1 && victim != NULL){
+    loadctl_set(victim, 1);
+    loadctl_swap_out(victim);
+    STAT_INC(loadctl_suspends);
+    logd(LOG_INFO, "pager loadctl suspends pid %d ws %d\n", (int)victim->pid, victim->ws);
+  } else if (resume != NULL && (active_ws + resume->ws <= usable
+      || period - resume->active_since >= LOADCTL_MAX_PERIODS || active == 0)){
+    loadctl_set(resume, 0);
+    STAT_INC(loadctl_resumes);
+    logd(LOG_INFO, "pager loadctl resumes pid %d ws %d\n", (int)resume->pid, resume->ws);
+  }
+  for (int i = 0; i < n; i++)
+    proc_put(procs[i]);
+  free(procs);
+}
+
+static void *loadctl(void *arg){
+  while (1){
+    usleep(my_config.loadctl * 1000);
+    loadctl_check();
+  }
+  return NULL;
+}
+
+static void loadctl_start(void){
+  pthread_t thread;
+  pthread_create(&thread, NULL, loadctl, NULL);
+  pthread_detach(thread);
+}
+
+/* KSM.  The scanner hashes resident frames every `ksm` milliseconds
+ * and merges frames with identical contents into one frame owned by
+ * FRAME_KSM, mapped read-only by every page in its mapper list.  A
+ * frame is only merged if its hash did not change since the previous
+ * pass, which keeps the scanner off pages being written.  Mapper
+ * lists are protected by `ksm_lock`, taken after any process lock;
+ * merges and evictions of shared frames run with `clock_lock` held. */
+static uint32_t ksm_checksum(int frame){
+  long pagesize = sysconf(_SC_PAGESIZE);
+  const uint64_t *w = (const uint64_t *)(pmem + frame*pagesize);
+  uint64_t h = 14695981039346656037ull;
+  for (int i = 0; i < pagesize/8; i++)
+    h = (h ^ w[i]) * 1099511628211ull;
+  return (uint32_t)(h ^ (h >> 32));
+}
+
+/* Turns `frame` into a shared frame with its current page as the only
+ * mapper, revoking write access.  Called with `clock_lock` held. */
+static int ksm_share(int frame){
+  struct proc *proc = frame_lock(frame);
+  if (proc == NULL)
+    return 0;
+  int page = my_pager.frame_page[frame];
+  struct ksm_mapper *m = malloc(sizeof(*m));
+  m->pid = proc->pid;
+  m->page = page;
+  m->clean = !bit_test(my_pager.dirty_bits, frame);
+  m->next = NULL;
+  if (my_pager.frame_prot[frame] != PROT_READ){
+    my_pager.frame_prot[frame] = PROT_READ;
+    mmu_chprot(proc->pid, page_to_addr(page), PROT_READ);
+  }
+  mmu_sync(proc->pid);
+  proc->pages[page].flags |= PAGE_KSM;
+  proc->pages[page].flags &= ~PAGE_PREFETCHED;
+  proc_rss_add(proc, -1);
+  pthread_mutex_lock(&my_pager.ksm_lock);
+  my_pager.ksm_mappers[frame] = m;
+  frame_set_owner(frame, FRAME_KSM);
+  pthread_mutex_unlock(&my_pager.ksm_lock);
+  frame_unlock(proc);
+  return 1;
+}
+
+/* Maps the page in `frame` to `target` if their contents are equal,
+ * sharing `target` first if needed, and frees `frame`.  Returns 1 if
+ * the pages were merged.  Called with `clock_lock` held. */
+static int ksm_merge(int frame, int target){
+  if (frame_owner(target) != FRAME_KSM && !ksm_share(target))
+    return 0;
+  struct proc *proc = frame_lock(frame);
+  if (proc == NULL)
+    return 0;
+  long pagesize = sysconf(_SC_PAGESIZE);
+  int page = my_pager.frame_page[frame];
+  /* stop writes before comparing; they fault and restore access */
+  if (my_pager.frame_prot[frame] & PROT_WRITE){
+    my_pager.frame_prot[frame] = PROT_READ;
+    mmu_chprot(proc->pid, page_to_addr(page), PROT_READ);
+  }
+  mmu_sync(proc->pid);
+  if (memcmp(pmem + frame*pagesize, pmem + target*pagesize, pagesize) != 0){
+    frame_unlock(proc);
+    return 0;
+  }
+
+  struct ksm_mapper *m = malloc(sizeof(*m));
+  m->pid = proc->pid;
+  m->page = page;
+  m->clean = !bit_test(my_pager.dirty_bits, frame);
+  pthread_mutex_lock(&my_pager.ksm_lock);
+  int shared = frame_owner(target) == FRAME_KSM;
+  if (shared){
+    m->next = my_pager.ksm_mappers[target];
+    my_pager.ksm_mappers[target] = m;
+    bit_set(my_pager.ref_bits, target);
+    if (++my_pager.ksm_saved > my_pager.ksm_saved_max)
+      my_pager.ksm_saved_max = my_pager.ksm_saved;
+  }
+  pthread_mutex_unlock(&my_pager.ksm_lock);
+  if (!shared){
+    /* its only mapper wrote to it meanwhile */
+    free(m);
+    frame_unlock(proc);
+    return 0;
+  }
+
+  pid_t pid = proc->pid;
+  struct page_data *pdata = &proc->pages[page];
+  pdata->frame = target;
+  pdata->flags |= PAGE_KSM;
+  pdata->flags &= ~PAGE_PREFETCHED;
+  frame_set_owner(frame, -1);
+  proc_rss_add(proc, -1);
+  mmu_resident(pid, page_to_addr(page), target, PROT_READ);
+  mmu_sync(pid);
+  frame_unlock(proc);
+  if (my_pager.policy->on_evict)
+    my_pager.policy->on_evict(frame, pid, -1);
+  frame_push(frame);
+  STAT_INC(ksm_merges);
+  return 1;
+}
+
+/* Returns a frame other than `frame` with checksum `sum` and the same
+ * contents, or -1.  The table is only used by the scanner thread. */
+static int ksm_lookup(int frame, uint32_t sum){
+  long pagesize = sysconf(_SC_PAGESIZE);
+  int mask = my_pager.ksm_table_size - 1;
+  for (int i = sum & mask; my_pager.ksm_table[i] != -1; i = (i+1) & mask){
+    int other = my_pager.ksm_table[i];
+    if (other != frame && my_pager.ksm_sums[other] == sum
+        && memcmp(pmem + frame*pagesize, pmem + other*pagesize, pagesize) == 0)
+      return other;
+  }
+  return -1;
+}
+
+static void ksm_insert(int frame){
+  int mask = my_pager.ksm_table_size - 1;
+  int i = my_pager.ksm_sums[frame] & mask;
+  while (my_pager.ksm_table[i] != -1)
+    i = (i+1) & mask;
+  my_pager.ksm_table[i] = frame;
+}
+
+/* One pass over physical memory.  Shared frames are read-only and go
+ * into the table first, so pages merge into them rather than into
+ * each other. */
+static void ksm_scan(void){
+  for (int i = 0; i < my_pager.ksm_table_size; i++)
+    my_pager.ksm_table[i] = -1;
+  for (int frame = 0; frame < my_pager.nframes; frame++){
+    if (frame_owner(frame) == FRAME_KSM)
+      ksm_insert(frame);
+  }
+  for (int frame = 0; frame < my_pager.nframes; frame++){
+    struct proc *proc = frame_lock(frame);
+    if (proc == NULL)
+      continue;
+    uint32_t sum = ksm_checksum(frame);
+    int stable = sum == my_pager.ksm_sums[frame];
+    my_pager.ksm_sums[frame] = sum;
+    frame_unlock(proc);
+    if (!stable)
+      continue;
+    int target = ksm_lookup(frame, sum);
+    if (target == -1){
+      ksm_insert(frame);
+      continue;
+    }
+    pthread_mutex_lock(&my_pager.clock_lock);
+    int merged = ksm_merge(frame, target);
+    pthread_mutex_unlock(&my_pager.clock_lock);
+    if (!merged)
+      ksm_insert(frame);
+  }
+}
+
+static void *ksm(void *arg){
+  while (1){
+    usleep(my_config.ksm * 1000);
+    struct timespec start, end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    ksm_scan();
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+    long ns = (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+    __atomic_add_fetch(&my_pager.stats.ksm_scan_ns, ns, __ATOMIC_RELAXED);
+    STAT_INC(ksm_scans);
+  }
+  return NULL;
+}
+
+static void ksm_start(void){
+  int n = my_pager.nframes;
+  my_pager.ksm_mappers = calloc(n, sizeof(struct ksm_mapper *));
+  my_pager.ksm_sums = calloc(n, sizeof(uint32_t));
+  my_pager.ksm_table_size = 1;
+  while (my_pager.ksm_table_size < 2*n)
+    my_pager.ksm_table_size *= 2;
+  my_pager.ksm_table = malloc(my_pager.ksm_table_size * sizeof(int));
+  pthread_t thread;
+  pthread_create(&thread, NULL, ksm, NULL);
+  pthread_detach(thread);
+}
+
+/* Pages out a shared frame from every page mapping it.  Each page's
+ * block is written unless it was clean when merged.  Pages for which
+ * no block can be allocated stay mapped, and the frame is then not
+ * evicted.  Called with `clock_lock` held. */
+static int ksm_evict(int frame){
+  pthread_mutex_lock(&my_pager.ksm_lock);
+  if (frame_owner(frame) != FRAME_KSM || bit_test(my_pager.ref_bits, frame)){
+    pthread_mutex_unlock(&my_pager.ksm_lock);
+    return 0;
+  }
+  struct ksm_mapper *m = my_pager.ksm_mappers[frame];
+  my_pager.ksm_mappers[frame] = NULL;
+  for (struct ksm_mapper *other = m->next; other != NULL; other = other->next)
+    my_pager.ksm_saved--;
+  frame_set_owner(frame, -1);
+  pthread_mutex_unlock(&my_pager.ksm_lock);
+
+  struct ksm_mapper *kept = NULL;
+  int nkept = 0;
+  while (m != NULL){
+    struct ksm_mapper *next = m->next;
+    struct proc *proc = proc_get(m->pid);
+    if (proc != NULL){
+      pthread_mutex_lock(&proc->lock);
+      struct page_data *pdata = &proc->pages[m->page];
+      int mapped = !proc->dead && m->page < proc->npages
+        && page_frame(pdata) == frame && (pdata->flags & PAGE_KSM);
+      if (mapped && !m->clean && pdata->block == -1
+          && (pdata->block = block_pop(proc)) == -1){
+        m->next = kept;
+        kept = m;
+        nkept++;
+        frame_unlock(proc);
+        m = next;
+        continue;
+      }
+      if (mapped){
+        pdata->flags &= ~PAGE_KSM;
+        pdata->frame = -1;
+        mmu_nonresident(proc->pid, page_to_addr(m->page));
+        mmu_sync(proc->pid);
+        if (m->clean){
+          STAT_INC(ksm_writes_saved);
         } else {
-          my_pager.frames[frame].prot = PROT_READ | PROT_WRITE;
-          my_pager.frames[frame].dirty = 1;
-          mmu_chprot(pid, page_to_addr(page), PROT_READ | PROT_WRITE);
+          pdata->flags |= PAGE_ON_DISK;
+          mmu_disk_write(frame, pdata->block);
+          STAT_INC(disk_writes);
         }
       }
-      
-      break;
+      frame_unlock(proc);
     }
+    free(m);
+    m = next;
   }
-  pthread_mutex_unlock(&my_pager.mutex);
+  if (kept != NULL){
+    pthread_mutex_lock(&my_pager.ksm_lock);
+    my_pager.ksm_mappers[frame] = kept;
+    my_pager.ksm_saved += nkept - 1;
+    frame_set_owner(frame, FRAME_KSM);
+    pthread_mutex_unlock(&my_pager.ksm_lock);
+    my_pager.block_shortage = 1;
+    STAT_INC(block_shortages);
+    return 0;
+  }
+  STAT_INC(evictions);
+  if (my_pager.policy->on_evict)
+    my_pager.policy->on_evict(frame, -1, -1);
+  return 1;
 }
 
-int pager_syslog(pid_t pid, void *addr, size_t len){
-  if ((long int)addr < UVM_BASEADDR || (long int)addr > UVM_MAXADDR)
-    return -1;
+/* Gives the page of `proc` mapping a shared frame write access to it
+ * if it is the frame's last mapper.  Returns 0 if the frame still has
+ * other mappers, so the page must be copied.  Called with the process
+ * lock held. */
+static int ksm_reuse(struct proc *proc, int page){
+  struct page_data *pdata = &proc->pages[page];
+  int frame = pdata->frame;
+  pthread_mutex_lock(&my_pager.ksm_lock);
+  struct ksm_mapper *m = my_pager.ksm_mappers[frame];
+  int last = frame_owner(frame) == FRAME_KSM && m != NULL && m->next == NULL;
+  if (last){
+    my_pager.ksm_mappers[frame] = NULL;
+    free(m);
+    my_pager.frame_page[frame] = page;
+    my_pager.frame_prot[frame] = PROT_READ | PROT_WRITE;
+    bit_set(my_pager.dirty_bits, frame);
+    bit_set(my_pager.ref_bits, frame);
+    frame_set_owner(frame, proc->pid);
+  }
+  pthread_mutex_unlock(&my_pager.ksm_lock);
+  if (!last)
+    return 0;
+  proc_rss_add(proc, 1);
+  pdata->flags &= ~PAGE_KSM;
+  mmu_chprot(proc->pid, page_to_addr(page), PROT_READ | PROT_WRITE);
+  STAT_INC(ksm_reuses);
+  return 1;
+}
 
-  pthread_mutex_lock(&my_pager.mutex);    
-  int initial_page = addr_to_page(addr); 
-  int final_page = addr_to_page((addr+len));
-
-  for (int i = 0; i < my_pager.n_procs; i++){
-    if (my_pager.pid2proc[i].pid==pid){
-      //verificar se o endereço pertence ao processo (imprimir mensagem de erro --> seg fault)
-      if (initial_page >= my_pager.pid2proc[i].npages || final_page >=my_pager.pid2proc[i].npages) {
-          printf("Segmentation fault: address out of processes range");
-          pthread_mutex_unlock(&my_pager.mutex);
-          exit(0);
+/* Removes `page` of `pid` from the mappers of shared `frame`.  Returns
+ * 1 if it was the last one, in which case the caller must release the
+ * frame.  Called with the process lock held. */
+static int ksm_unmap(int frame, pid_t pid, int page){
+  int last = 0;
+  pthread_mutex_lock(&my_pager.ksm_lock);
+  if (frame_owner(frame) == FRAME_KSM){
+    for (struct ksm_mapper **mp = &my_pager.ksm_mappers[frame]; *mp != NULL; mp = &(*mp)->next){
+      if ((*mp)->pid == pid && (*mp)->page == page){
+        struct ksm_mapper *m = *mp;
+        *mp = m->next;
+        free(m);
+        if (my_pager.ksm_mappers[frame] != NULL)
+          my_pager.ksm_saved--;
+        break;
       }
+    }
+    if (my_pager.ksm_mappers[frame] == NULL){
+      frame_set_owner(frame, -1);
+      last = 1;
+    }
+  }
+  pthread_mutex_unlock(&my_pager.ksm_lock);
+  return last;
+}
 
-      int byte_atual = 0;
-      char buf[len];
-      for (int page = initial_page; page <= final_page; page++){
-        for (; byte_atual < sysconf(_SC_PAGE_SIZE) && byte_atual+page*sysconf(_SC_PAGE_SIZE)<len ; byte_atual++){
-          buf[page*sysconf(_SC_PAGE_SIZE)+byte_atual] = (char)pmem[my_pager.pid2proc[i].pages[page].frame + byte_atual];
-          printf("%02x", (unsigned)buf[page*sysconf(_SC_PAGE_SIZE)+byte_atual]);
-        }
+/* Returns frames of an exiting process to the free stack.  Called
+ * without any process lock held. */
+static void frames_release(pid_t pid, int *frames, int n){
+  if (my_pager.policy->on_evict){
+    pthread_mutex_lock(&my_pager.clock_lock);
+    for (int i = 0; i < n; i++)
+      my_pager.policy->on_evict(frames[i], pid, -1);
+    pthread_mutex_unlock(&my_pager.clock_lock);
+  }
+  for (int i = 0; i < n; i++)
+    frame_push(frames[i]);
+}
+
+/* Loads `page` of `proc` into `frame`, from the zswap pool, its block
+ * or zeroed, and maps it with `prot`.  Pages coming from the pool are
+ * only in memory, so the frame starts dirty.  Called with the process
+ * lock held. */
+static void page_map(struct proc *proc, int page, int frame, int prot, int dirty);
+
+static void page_load(struct proc *proc, int page, int frame, int prot){
+  struct page_data *pdata = &proc->pages[page];
+  int dirty = 0;
+
+  if (pdata->flags & PAGE_ZSWAP){
+    mmu_zswap_load(pdata->frame, frame);
+    mmu_zswap_free(pdata->frame);
+    pdata->flags &= ~PAGE_ZSWAP;
+    dirty = 1;
+    STAT_INC(zswap_loads);
+  } else if(pdata->flags & PAGE_ON_DISK){
+    int block = proc->pages[page].block;
+    mmu_disk_read(block, frame);
+    STAT_INC(disk_reads);
+  } else {
+    mmu_zero_fill(frame);
+    STAT_INC(zero_fills);
+  }
+  page_map(proc, page, frame, prot, dirty);
+}
+
+/* Records `page` of `proc` as held in the already filled `frame`,
+ * leaving it to the caller to map it in the process.  Called with the
+ * process lock held. */
+static void page_set(struct proc *proc, int page, int frame, int prot, int dirty){
+  my_pager.frame_page[frame] = page;
+  bit_set(my_pager.ref_bits, frame);
+  proc->pages[page].frame = frame;
+  my_pager.frame_prot[frame] = prot;
+  bit_assign(my_pager.dirty_bits, frame, dirty);
+  frame_set_owner(frame, proc->pid);
+  proc_rss_add(proc, 1);
+}
+
+/* Maps `page` of `proc` to the already filled `frame`.  Called with
+ * the process lock held. */
+static void page_map(struct proc *proc, int page, int frame, int prot, int dirty){
+  page_set(proc, page, frame, prot, dirty);
+  mmu_resident(proc->pid, page_to_addr(page), frame, prot);
+}
+
+/* Updates the sequential stream of `proc` for a fault on non-resident
+ * `page` and returns how many pages after it to prefetch.  A fault
+ * where the stream was expected to continue means earlier prefetched
+ * pages were used, and doubles the window.  Called with the process
+ * lock held. */
+static int readahead_window(struct proc *proc, int page){
+  if (page == proc->ra_next){
+    for (int q = proc->ra_start; q < page; q++){
+      if (proc->pages[q].flags & PAGE_PREFETCHED){
+        proc->pages[q].flags &= ~PAGE_PREFETCHED;
+        STAT_INC(readahead_hits);
       }
-      printf("\n");
-      pthread_mutex_unlock(&my_pager.mutex);
+    }
+    proc->ra_window = proc->ra_window ? proc->ra_window*2 : 1;
+    if (proc->ra_window > my_config.readahead)
+      proc->ra_window = my_config.readahead;
+  } else {
+    proc->ra_window = 0;
+  }
+  int n = proc->ra_window;
+  if (n > proc->npages - page - 1)
+    n = proc->npages - page - 1;
+  proc->ra_start = page + 1;
+  proc->ra_next = page + 1;
+  return n;
+}
+
+/* Returns how many of the `n` pages from `first` on are on disk, not
+ * resident, in consecutive blocks; 0 if fewer than two.  Called with
+ * the process lock held. */
+static int swapin_run(struct proc *proc, int first, int n){
+  int run = 0;
+  while (run < n && first + run < proc->npages){
+    struct page_data *pdata = &proc->pages[first + run];
+    if (page_frame(pdata) != -1 || !(pdata->flags & PAGE_ON_DISK)
+        || pdata->block != proc->pages[first].block + run)
+      break;
+    run++;
+  }
+  return run >= 2 ? run : 0;
+}
+
+/* Prefetches the pages from `first` on, up to `n`, that are on disk
+ * in consecutive blocks, reading them in one transfer.  Returns the
+ * number of pages loaded.  Called without the process lock. */
+static int readahead_cluster(struct proc *proc, int first, int n){
+  pthread_mutex_lock(&proc->lock);
+  int run = swapin_run(proc, first, n);
+  pthread_mutex_unlock(&proc->lock);
+  if (run == 0)
+    return 0;
+  int frames[run];
+  int got = 0;
+  while (got < run && (frames[got] = frame_get(proc, first + got, 0)) != -1)
+    got++;
+  pthread_mutex_lock(&proc->lock);
+  run = proc->dead ? 0 : swapin_run(proc, first, got);
+  if (run > 0){
+    mmu_disk_read_vec(proc->pages[first].block, frames, run);
+    void *vaddrs[run];
+    int prots[run];
+    for (int i = 0; i < run; i++){
+      if (my_config.protvec)
+        page_set(proc, first + i, frames[i], PROT_READ, 0);
+      else
+        page_map(proc, first + i, frames[i], PROT_READ, 0);
+      bit_clear(my_pager.ref_bits, frames[i]);
+      proc->pages[first + i].flags |= PAGE_PREFETCHED;
+      vaddrs[i] = page_to_addr(first + i);
+      prots[i] = PROT_READ;
+    }
+    if (my_config.protvec){
+      mmu_resident_vec(proc->pid, vaddrs, frames, prots, run);
+      STAT_INC(protvec_msgs);
+      __atomic_add_fetch(&my_pager.stats.protvec_pages, run, __ATOMIC_RELAXED);
+    }
+    proc->ra_next = first + run;
+    STAT_INC(cluster_reads);
+    __atomic_add_fetch(&my_pager.stats.cluster_read_pages, run, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&my_pager.stats.readahead_pages, run, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&my_pager.stats.disk_reads, run, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&proc->lock);
+  if (got > run)
+    frames_release(proc->pid, frames + run, got - run);
+  return run;
+}
+
+/* Prefetches up to `n` non-resident pages starting at `first` into
+ * free frames, mapping them read-only.  Readahead never evicts: it
+ * stops when no frame is free.  Called without the process lock. */
+static void readahead(struct proc *proc, int first, int n){
+  if (my_config.swapcluster > 0){
+    int done = readahead_cluster(proc, first, n);
+    first += done;
+    n -= done;
+  }
+  for (int page = first; page < first + n; page++){
+    pthread_mutex_lock(&proc->lock);
+    int untouched = page < proc->npages
+      && !(proc->pages[page].flags & (PAGE_ON_DISK | PAGE_ZSWAP));
+    pthread_mutex_unlock(&proc->lock);
+    if (untouched && my_pager.zero_frame != -1)
+      continue;
+    int frame = frame_get(proc, page, 0);
+    if (frame == -1)
+      break;
+    pthread_mutex_lock(&proc->lock);
+    if (proc->dead || page >= proc->npages || page_frame(&proc->pages[page]) != -1){
+      int dead = proc->dead;
+      pthread_mutex_unlock(&proc->lock);
+      frames_release(proc->pid, &frame, 1);
+      if (dead)
+        break;
+      continue;
+    }
+    page_load(proc, page, frame, PROT_READ);
+    bit_clear(my_pager.ref_bits, frame);
+    proc->pages[page].flags |= PAGE_PREFETCHED;
+    proc->ra_next = page + 1;
+    STAT_INC(readahead_pages);
+    pthread_mutex_unlock(&proc->lock);
+  }
+}
+
+/* Services a fault of `pid` at `addr`.  If `write` is set the access
+ * is known to be a write, and the page is made writable and dirty in
+ * one step.  Returns -1 if `addr` is outside the process's pages or
+ * memory ran out, and PAGER_DEFERRED if load control has suspended the
+ * process. */
+static int fault(pid_t pid, void *addr, int write){
+  struct proc *proc = proc_get(pid);
+  if (proc == NULL)
+    return 0;
+  if (my_config.loadctl > 0 && loadctl_defer(proc)){
+    proc_put(proc);
+    return PAGER_DEFERRED;
+  }
+
+  int page = addr_to_page(addr);
+
+  lock_timed(&proc->lock);
+  if (page >= proc->npages || page < 0){
+    logd(LOG_WARN, "pager fault pid %d addr %p out of range\n", (int)pid, addr);
+    pthread_mutex_unlock(&proc->lock);
+    proc_put(proc);
+    return -1;
+  }
+
+  STAT_INC(faults);
+  proc->faults++;
+  proc->ws_bits[page/64] |= 1ull << (page%64);
+  int ra = 0;
+  struct page_data *pdata = &proc->pages[page];
+  int frame = page_frame(pdata);
+  if (frame == -1 && my_pager.zero_frame != -1 && !write
+      && !(pdata->flags & (PAGE_ON_DISK | PAGE_ZERO | PAGE_ZSWAP))){
+    /* first touch reads the shared zero frame */
+    pdata->flags |= PAGE_ZERO;
+    mmu_resident(pid, page_to_addr(page), my_pager.zero_frame, PROT_READ);
+    STAT_INC(zero_maps);
+    pthread_mutex_unlock(&proc->lock);
+    proc_put(proc);
+    return 0;
+  }
+  if (pdata->flags & PAGE_ZERO){
+    /* the zero frame is never writable, so this is the first write:
+     * copy it (i.e., zero fill) into a private frame */
+    write = 1;
+    STAT_INC(zero_cows);
+  }
+  int cow = -1, cow_free = -1;
+  if (frame != -1 && (pdata->flags & PAGE_KSM)){
+    /* shared frames are read-only, so this is a write */
+    if (ksm_reuse(proc, page)){
+      pthread_mutex_unlock(&proc->lock);
+      proc_put(proc);
       return 0;
     }
+    write = 1;
+    cow = frame;
+    frame = -1;
+  }
+  if(frame == -1){
+    proc->major_faults++;
+    pthread_mutex_unlock(&proc->lock);
+    frame = frame_get(proc, page, 1);
+    if (frame == -1){
+      /* out of memory: fail the process asking for more; its pid is
+       * only what the client claimed, so never signal it */
+      logd(LOG_WARN, "pager out of memory, failing pid %d\n", (int)pid);
+      STAT_INC(oom_kills);
+      proc_put(proc);
+      return -1;
+    }
+    lock_timed(&proc->lock);
+    if (proc->dead){
+      pthread_mutex_unlock(&proc->lock);
+      frames_release(pid, &frame, 1);
+      proc_put(proc);
+      return 0;
+    }
+    pdata->flags &= ~PAGE_ZERO;
+    if (cow != -1 && page_frame(pdata) == cow && (pdata->flags & PAGE_KSM)){
+      if (ksm_unmap(cow, pid, page))
+        cow_free = cow;
+      pdata->flags &= ~PAGE_KSM;
+      mmu_copy_frame(cow, frame);
+      page_map(proc, page, frame, PROT_READ | PROT_WRITE, 1);
+      if (cow_free != -1)
+        mmu_sync(pid);
+      STAT_INC(ksm_cows);
+    } else if (write){
+      page_load(proc, page, frame, PROT_READ | PROT_WRITE);
+      bit_set(my_pager.dirty_bits, frame);
+    } else {
+      page_load(proc, page, frame, PROT_READ);
+    }
+    if (my_config.readahead > 0)
+      ra = readahead_window(proc, page);
+  } else{
+    STAT_INC(minor_faults);
+    bit_set(my_pager.ref_bits, frame);
+    if (my_pager.policy->on_access)
+      my_pager.policy->on_access(frame);
+    if (proc->pages[page].flags & PAGE_PREFETCHED){
+      proc->pages[page].flags &= ~PAGE_PREFETCHED;
+      STAT_INC(readahead_hits);
+    }
+
+    if (my_pager.frame_prot[frame]==PROT_NONE && !write){
+      my_pager.frame_prot[frame] = PROT_READ;
+      mmu_chprot(pid, page_to_addr(page), PROT_READ);
+    } else {
+      my_pager.frame_prot[frame] = PROT_READ | PROT_WRITE;
+      bit_set(my_pager.dirty_bits, frame);
+      mmu_chprot(pid, page_to_addr(page), PROT_READ | PROT_WRITE);
+    }
+  }
+  pthread_mutex_unlock(&proc->lock);
+  if (cow_free != -1)
+    frames_release(pid, &cow_free, 1);
+  if (ra > 0)
+    readahead(proc, page + 1, ra);
+  proc_put(proc);
+  return 0;
+}
+
+int pager_fault(pid_t pid, void *addr){
+  return fault(pid, addr, 0);
+}
+
+int pager_fault_write(pid_t pid, void *addr){
+  if (my_config.writefault)
+    STAT_INC(write_faults);
+  return fault(pid, addr, my_config.writefault);
+}
+
+/* Two hex digits per byte value, so encoding is a table load and a
+ * two-byte store per byte. */
+static uint16_t hex_table[256];
+static pthread_once_t hex_once = PTHREAD_ONCE_INIT;
+
+static void hex_init(void){
+  const char *digits = "0123456789abcdef";
+  for (int i = 0; i < 256; i++){
+    char pair[2] = { digits[i >> 4], digits[i & 15] };
+    memcpy(&hex_table[i], pair, sizeof(pair));
   }
-  pthread_mutex_unlock(&my_pager.mutex);
-	return -1;
+}
+
+static void hex_encode(char *out, const unsigned char *in, size_t n){
+  for (size_t i = 0; i < n; i++)
+    memcpy(out + 2*i, &hex_table[in[i]], 2);
+}
+
+/* Output buffer of the syslog calls made by each MMU thread; it only
+ * grows, so steady-state syslogs do not allocate. */
+static __thread char *syslog_buf;
+static __thread size_t syslog_cap;
+
+static int syslog_reserve(size_t n){
+  if (n <= syslog_cap)
+    return 0;
+  char *buf = realloc(syslog_buf, n);
+  if (buf == NULL)
+    return -1;
+  syslog_buf = buf;
+  syslog_cap = n;
+  return 0;
+}
+
+/* Hex-encodes `n` bytes at `offset` in `page` of `proc` into `out`,
+ * faulting the page in if it is not resident.  Pages mapped to the
+ * shared zero frame are read from it.  Returns -1 if the page could
+ * not be brought in, or PAGER_DEFERRED if the fault was deferred. */
+static int syslog_page(struct proc *proc, int page, size_t offset, size_t n, char *out){
+  long pagesize = sysconf(_SC_PAGESIZE);
+  for (int tries = 0; tries < 3; tries++){
+    pthread_mutex_lock(&proc->lock);
+    struct page_data *pdata = &proc->pages[page];
+    int frame = page_frame(pdata);
+    if (pdata->flags & PAGE_ZERO)
+      frame = my_pager.zero_frame;
+    if (frame != -1){
+      hex_encode(out, (const unsigned char *)pmem + (size_t)frame*pagesize + offset, n);
+      pthread_mutex_unlock(&proc->lock);
+      return 0;
+    }
+    pthread_mutex_unlock(&proc->lock);
+    if (fault(proc->pid, page_to_addr(page), 0) == PAGER_DEFERRED)
+      return PAGER_DEFERRED;
+  }
+  return -1;
+}
+
+/* Writes all of `buf` to standard output.  The caller holds the
+ * stdout lock and has flushed it, so the write stays ordered with the
+ * MMU's own messages. */
+static int syslog_write(const char *buf, size_t n){
+  while (n > 0){
+    ssize_t w = write(STDOUT_FILENO, buf, n);
+    if (w == -1)
+      return -1;
+    buf += w;
+    n -= w;
+  }
+  return 0;
+}
+
+int pager_syslog(pid_t pid, void *addr, size_t len){
+  long pagesize = sysconf(_SC_PAGESIZE);
+  if ((intptr_t)addr < UVM_BASEADDR || (intptr_t)addr > UVM_MAXADDR
+      || len > (size_t)(UVM_MAXADDR - (intptr_t)addr) + 1){
+    errno = EINVAL;
+    return -1;
+  }
+
+  struct proc *proc = proc_get(pid);
+  if (proc == NULL){
+    errno = EINVAL;
+    return -1;
+  }
+
+  int first_page = addr_to_page(addr);
+  int last_page = len > 0 ? addr_to_page((char *)addr + len - 1) : first_page;
+  pthread_mutex_lock(&proc->lock);
+  int valid = last_page < proc->npages;
+  pthread_mutex_unlock(&proc->lock);
+  if (!valid || syslog_reserve(2*len + 1) == -1){
+    proc_put(proc);
+    errno = EINVAL;
+    return -1;
+  }
+
+  pthread_once(&hex_once, hex_init);
+  char *out = syslog_buf;
+  size_t offset = ((intptr_t)addr - UVM_BASEADDR) % pagesize;
+  size_t left = len;
+  for (int page = first_page; left > 0; page++){
+    size_t n = pagesize - offset;
+    if (n > left)
+      n = left;
+    int r = syslog_page(proc, page, offset, n, out);
+    if (r != 0){
+      proc_put(proc);
+      if (r == -1)
+        errno = EINVAL;
+      return r;
+    }
+    out += 2*n;
+    left -= n;
+    offset = 0;
+  }
+  *out++ = '\n';
+  proc_put(proc);
+
+  flockfile(stdout);
+  fflush(stdout);
+  int r = syslog_write(syslog_buf, out - syslog_buf);
+  funlockfile(stdout);
+  return r;
+}
+
+/* Drops the contents of `page` of `proc`, as if it was never touched:
+ * its frame is unmapped and stored in `*frame` for the caller to free
+ * (-1 if there is none).  With `lazyswap` its block is returned to the
+ * free stack and allocated again when the page is next paged out; the
+ * commit charge of the page is kept.  Otherwise the page keeps its
+ * block, so it can always be paged out again.  Called with the process
+ * lock held. */
+static void page_release(struct proc *proc, int page, int *frame){
+  struct page_data *pdata = &proc->pages[page];
+  *frame = -1;
+  if (pdata->flags & PAGE_ZSWAP){
+    mmu_zswap_free(pdata->frame);
+  } else if (pdata->flags & PAGE_KSM){
+    if (ksm_unmap(pdata->frame, proc->pid, page))
+      *frame = pdata->frame;
+    mmu_nonresident(proc->pid, page_to_addr(page));
+  } else if (pdata->frame != -1){
+    *frame = pdata->frame;
+    frame_set_owner(*frame, -1);
+    proc_rss_add(proc, -1);
+    mmu_nonresident(proc->pid, page_to_addr(page));
+  } else if (pdata->flags & PAGE_ZERO){
+    mmu_nonresident(proc->pid, page_to_addr(page));
+  }
+  if (my_config.lazyswap && pdata->block != -1){
+    block_push(pdata->block);
+    pdata->block = -1;
+  }
+  pdata->frame = -1;
+  pdata->flags = 0;
+}
+
+int pager_release(pid_t pid, void *addr, int n){
+  struct proc *proc = proc_get(pid);
+  if (proc == NULL){
+    errno = EINVAL;
+    return -1;
+  }
+  int first = addr_to_page(addr);
+  pthread_mutex_lock(&proc->lock);
+  if ((long)addr < UVM_BASEADDR || n < 1 || first + (long)n > proc->npages
+      || addr != page_to_addr(first)){
+    pthread_mutex_unlock(&proc->lock);
+    proc_put(proc);
+    errno = EINVAL;
+    return -1;
+  }
+  int nfreed = 0;
+  int frames[n];
+  for (int page = first; page < first + n; page++){
+    page_release(proc, page, &frames[nfreed]);
+    if (frames[nfreed] != -1)
+      nfreed++;
+  }
+  mmu_sync(pid);
+  pthread_mutex_unlock(&proc->lock);
+  frames_release(pid, frames, nfreed);
+  __atomic_add_fetch(&my_pager.stats.released_pages, n, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&my_pager.stats.released_frames, nfreed, __ATOMIC_RELAXED);
+  proc_put(proc);
+  return 0;
 }
 
 void pager_destroy(pid_t pid){
-  pthread_mutex_lock(&my_pager.mutex);
-
-  for (int i = 0; i < my_pager.n_procs; i++){
-      if (my_pager.pid2proc[i].pid == pid){
-        my_pager.pid2proc[i].pid = -1;
-        for (int j = 0; j < my_pager.pid2proc[i].npages; j++){
-          int bloco_liberado = my_pager.pid2proc[i].pages[j].block;
-          my_pager.blocks_free++;
-          my_pager.blocks_free_stack[my_pager.blocks_free] = bloco_liberado;
-          int frame_liberado = my_pager.pid2proc[i].pages[j].frame;
-          if (frame_liberado!=-1){
-            my_pager.frames_free++;
-            my_pager.free_frames_stack[my_pager.frames_free] = frame_liberado;
-          }
-          my_pager.block2pid[bloco_liberado] = -1;
-        }
-        my_pager.pid2proc[i].npages = 0;
-        my_pager.pid2proc[i].maxpages = 0;
-        free(my_pager.pid2proc[i].pages);
-        my_pager.n_procs--;
-        break;
-      }
+  pthread_rwlock_wrlock(&my_pager.table_lock);
+  struct proc *proc = proc_table_remove(&my_pager.pid2proc, pid);
+  if (proc != NULL)
+    my_pager.n_procs--;
+  pthread_rwlock_unlock(&my_pager.table_lock);
+  if (proc == NULL)
+    return;
+
+  int nliberados = 0;
+  int *frames_liberados = malloc(sizeof(int)*proc->maxpages);
+
+  pthread_mutex_lock(&proc->lock);
+  proc->dead = 1;
+  logd(LOG_INFO, "pager pid %d faults %ld major %ld rss_peak %d local_evictions %ld\n",
+      (int)pid, proc->faults, proc->major_faults, proc->rss_peak, proc->local_evictions);
+  for (int j = 0; j < proc->npages; j++){
+    if (proc->pages[j].block != -1)
+      block_push(proc->pages[j].block);
+    if (proc->pages[j].flags & PAGE_ZSWAP){
+      mmu_zswap_free(proc->pages[j].frame);
+      continue;
+    }
+    if (proc->pages[j].flags & PAGE_KSM){
+      if (ksm_unmap(proc->pages[j].frame, pid, j))
+        frames_liberados[nliberados++] = proc->pages[j].frame;
+      continue;
+    }
+    int frame_liberado = proc->pages[j].frame;
+    if (frame_liberado!=-1){
+      frame_set_owner(frame_liberado, -1);
+      frames_liberados[nliberados++] = frame_liberado;
+    }
+  }
+  if (my_config.lazyswap){
+    pthread_mutex_lock(&my_pager.blocks_lock);
+    my_pager.committed -= proc->npages;
+    pthread_mutex_unlock(&my_pager.blocks_lock);
   }
+  proc->npages = 0;
+  pthread_mutex_unlock(&proc->lock);
+
+  frames_release(pid, frames_liberados, nliberados);
+  free(frames_liberados);
 
-  pthread_mutex_unlock(&my_pager.mutex);
+  proc_put(proc);
 }
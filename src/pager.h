@@ -13,10 +13,31 @@
  * backing store, respectively. */
 void pager_init(int nframes, int nblocks);
 
+/* `pager_option` sets pager tunable `name` to `value`.  It is called
+ * by the memory management infrastructure for each option given on
+ * the command line, before `pager_init`.  The replacement policy is
+ * selected with name "policy" (see policy.h for the available ones).
+ * Returns 0 on success and -1 if `name` is unknown or `value`
+ * invalid. */
+int pager_option(const char *name, const char *value);
+
+/* `pager_report` logs the pager's counters (faults, disk reads and
+ * writes, evictions, etc.).  It is called when the MMU shuts down. */
+void pager_report(void);
+
 /* `pager_create` should initialize any resources the pager needs to
  * manage memory for a new process `pid`. */
 void pager_create(pid_t pid);
 
+/* `pager_set_quota` sets the resident-set quota of process `pid`:
+ * up to `min` of its frames are kept when other processes fault, and
+ * once it holds `max` frames its faults replace its own pages (zero
+ * means no limit).  New processes get the quota set by options
+ * "rssmin" and "rssmax".  Returns -1 if `pid` is unknown or the
+ * limits are invalid (negative, `min` above a nonzero `max`, or `min`
+ * not below the number of frames), 0 otherwise. */
+int pager_set_quota(pid_t pid, int min, int max);
+
 /* `pager_extend` allocates a new page of memory to process `pid`
  * and returns a pointer to that memory in the process's address
  * space.  `pager_extend` need not zero memory or install mappings
@@ -26,6 +47,13 @@ void pager_create(pid_t pid);
  * use as backing storage. */
 void *pager_extend(pid_t pid);
 
+/* `pager_extend_range` allocates `n` contiguous pages to process
+ * `pid` at once, as `n` calls to `pager_extend` would, and returns
+ * the address of the first.  Either all pages are allocated or none
+ * is: it returns NULL if the address space or the disk blocks cannot
+ * hold `n` more pages. */
+void *pager_extend_range(pid_t pid, int n);
+
 /* `pager_fault` is called when process `pid` receives
  * a segmentation fault at address `addr`.  `pager_fault` is only
  * called for addresses previously returned with `pager_extend`.  If
@@ -37,8 +65,22 @@ void *pager_extend(pid_t pid);
  * accesses the same (i.e., do not prioritize either).  As the
  * memory management infrastructure does not maintain page access
  * and writing information, your pager must track this information
- * to implement the second-chance algorithm. */
-void pager_fault(pid_t pid, void *addr);
+ * to implement the second-chance algorithm.  Returns 0, or -1 if
+ * `addr` is outside the pages of `pid` or no frame can be found for
+ * it, in which case the infrastructure drops the process.  Returns
+ * `PAGER_DEFERRED`, without servicing the fault, if option "loadctl"
+ * has suspended the process; the infrastructure then holds the
+ * request and makes it again after the pager calls `mmu_resume` for
+ * `pid`. */
+#define PAGER_DEFERRED 1
+int pager_fault(pid_t pid, void *addr);
+
+/* `pager_fault_write` is called instead of `pager_fault` when the
+ * infrastructure knows the faulting access was a write.  With option
+ * "writefault" set, the pager maps the page read-write and marks it
+ * dirty right away, saving the second fault a write to a read-only
+ * page would take; otherwise it behaves exactly like `pager_fault`. */
+int pager_fault_write(pid_t pid, void *addr);
 
 /* `pager_syslog prints a message made of `len` bytes following
  * `addr` in the address space of process `pid`.  `pager_syslog`
@@ -46,9 +88,20 @@ void pager_fault(pid_t pid, void *addr);
  * (zeroing and swapping in pages from disk if necessary).  If the
  * processes tries to syslog a memory region it has not allocated,
  * then `pager_syslog` should return -1 and set errno to EINVAL; if
- * the syslog succeeds, it should return 0. */
+ * the syslog succeeds, it should return 0.  Like `pager_fault`, it
+ * returns `PAGER_DEFERRED` if it needs to fault in a page of a
+ * suspended process. */
 int pager_syslog(pid_t pid, void *addr, size_t len);
 
+/* `pager_release` discards the contents of the `n` pages starting at
+ * page-aligned `addr` in the address space of process `pid`, like
+ * madvise(MADV_DONTNEED): their frames go back to the free stack at
+ * once, as do their disk blocks with option "lazyswap", and the pages
+ * read as zeroes when next touched.  The pages stay allocated.
+ * Returns -1 and sets errno to EINVAL if the range is not within the
+ * pages the process allocated, 0 otherwise. */
+int pager_release(pid_t pid, void *addr, int n);
+
 /* `pager_destroy` is called when the process is already dead.  It
  * should free all resources process `pid` allocated (memory frames
  * and disk blocks).  `pager_destroy` should not call any of the MMU
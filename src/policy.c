@@ -0,0 +1,474 @@
+#include "policy.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static int nframes;
+
+static int min(int a, int b){ return a < b ? a : b; }
+static int max(int a, int b){ return a > b ? a : b; }
+
+/* Ghost lists remember non-resident pages by (pid, page) for the
+ * adaptive policies.  Ghosts live in one pool, are found through a
+ * chained hash, and each list is kept in LRU order (head is the least
+ * recently inserted). */
+struct ghost {
+  pid_t pid;
+  int page;
+  struct ghost_list *list;
+  int prev;
+  int next;
+  int hnext;
+};
+
+struct ghost_list {
+  int head;
+  int tail;
+  int count;
+};
+
+static struct ghost *ghosts;
+static int ghost_free;
+static int *ghost_buckets;
+static int nbuckets;
+
+static unsigned ghost_hash(pid_t pid, int page){
+  return ((unsigned)pid * 2654435761u ^ (unsigned)page * 40503u) % nbuckets;
+}
+
+static void ghost_init(int capacity){
+  free(ghosts);
+  free(ghost_buckets);
+  nbuckets = capacity;
+  ghosts = malloc(sizeof(struct ghost)*capacity);
+  ghost_buckets = malloc(sizeof(int)*nbuckets);
+  for (int i = 0; i < nbuckets; i++)
+    ghost_buckets[i] = -1;
+  for (int i = 0; i < capacity; i++){
+    ghosts[i].list = NULL;
+    ghosts[i].next = i+1 < capacity ? i+1 : -1;
+  }
+  ghost_free = 0;
+}
+
+static void ghost_list_init(struct ghost_list *l){
+  l->head = l->tail = -1;
+  l->count = 0;
+}
+
+static int ghost_find(pid_t pid, int page){
+  for (int g = ghost_buckets[ghost_hash(pid, page)]; g != -1; g = ghosts[g].hnext){
+    if (ghosts[g].pid == pid && ghosts[g].page == page)
+      return g;
+  }
+  return -1;
+}
+
+static void ghost_remove(int g){
+  struct ghost_list *l = ghosts[g].list;
+  if (ghosts[g].prev != -1) ghosts[ghosts[g].prev].next = ghosts[g].next;
+  else l->head = ghosts[g].next;
+  if (ghosts[g].next != -1) ghosts[ghosts[g].next].prev = ghosts[g].prev;
+  else l->tail = ghosts[g].prev;
+  l->count--;
+
+  int *link = &ghost_buckets[ghost_hash(ghosts[g].pid, ghosts[g].page)];
+  while (*link != g)
+    link = &ghosts[*link].hnext;
+  *link = ghosts[g].hnext;
+
+  ghosts[g].list = NULL;
+  ghosts[g].next = ghost_free;
+  ghost_free = g;
+}
+
+/* Adds a ghost at the MRU end of `l`.  If the pool is full, the LRU
+ * ghost of `victim` is dropped to make room. */
+static void ghost_add(struct ghost_list *l, struct ghost_list *victim, pid_t pid, int page){
+  if (ghost_free == -1)
+    ghost_remove(victim->count > 0 ? victim->head : l->head);
+  int g = ghost_free;
+  ghost_free = ghosts[g].next;
+  ghosts[g].pid = pid;
+  ghosts[g].page = page;
+  ghosts[g].list = l;
+  ghosts[g].prev = l->tail;
+  ghosts[g].next = -1;
+  if (l->tail != -1) ghosts[l->tail].next = g;
+  else l->head = g;
+  l->tail = g;
+  l->count++;
+  unsigned h = ghost_hash(pid, page);
+  ghosts[g].hnext = ghost_buckets[h];
+  ghost_buckets[h] = g;
+}
+
+/* Frame lists: doubly-linked FIFOs of resident frames, threaded
+ * through per-frame arrays. */
+struct frame_list {
+  int head;
+  int tail;
+  int count;
+};
+
+static int *fprev;
+static int *fnext;
+static struct frame_list **flist_of;
+
+static void frame_lists_init(void){
+  free(fprev);
+  free(fnext);
+  free(flist_of);
+  fprev = malloc(sizeof(int)*nframes);
+  fnext = malloc(sizeof(int)*nframes);
+  flist_of = calloc(nframes, sizeof(struct frame_list *));
+}
+
+static void flist_init(struct frame_list *l){
+  l->head = l->tail = -1;
+  l->count = 0;
+}
+
+static void flist_append(struct frame_list *l, int f){
+  fprev[f] = l->tail;
+  fnext[f] = -1;
+  if (l->tail != -1) fnext[l->tail] = f;
+  else l->head = f;
+  l->tail = f;
+  l->count++;
+  flist_of[f] = l;
+}
+
+static void flist_remove(int f){
+  struct frame_list *l = flist_of[f];
+  if (fprev[f] != -1) fnext[fprev[f]] = fnext[f];
+  else l->head = fnext[f];
+  if (fnext[f] != -1) fprev[fnext[f]] = fprev[f];
+  else l->tail = fprev[f];
+  l->count--;
+  flist_of[f] = NULL;
+}
+
+/****************************************************************************
+ * clock: second chance over frames in index order
+ ***************************************************************************/
+static int clock_hand;
+
+static void clock_init(int n){
+  nframes = n;
+  clock_hand = 0;
+}
+
+/* Two sweeps from the hand, like aging frame by frame, since the
+ * first sweep may find every frame referenced. */
+static int clock_select(void){
+  int victim = pager_frame_scan(clock_hand, nframes);
+  if (victim == -1)
+    victim = pager_frame_scan(0, nframes);
+  if (victim == -1)
+    victim = pager_frame_scan(0, clock_hand);
+  if (victim == -1)
+    return -1;
+  clock_hand = (victim+1) % nframes;
+  return victim;
+}
+
+/****************************************************************************
+ * clock2: two-handed clock.  The front hand clears reference bits and
+ * the back hand, `handspread` frames behind, evicts frames that were
+ * not referenced since the front hand passed.
+ ***************************************************************************/
+static int handspread = 0;
+static int clock2_spread;
+static int clock2_back;
+
+static void clock2_init(int n){
+  nframes = n;
+  clock2_back = 0;
+  clock2_spread = handspread > 0 ? min(handspread, n-1) : max(1, n/4);
+  if (clock2_spread < 1)
+    clock2_spread = 1;
+}
+
+static int clock2_select(void){
+  for (int n = 0; n < 4*nframes; n++){
+    pager_frame_age((clock2_back + clock2_spread) % nframes);
+    int victim = clock2_back;
+    clock2_back = (clock2_back+1) % nframes;
+    if (pager_frame_test(victim) == 0)
+      return victim;
+  }
+  return -1;
+}
+
+/****************************************************************************
+ * wsclock: evicts frames not used within the last `tau` faults,
+ * preferring clean ones.  Virtual time advances on every fault.
+ ***************************************************************************/
+static int tau = 0;
+static int wsclock_tau;
+static int wsclock_hand;
+static unsigned long wsclock_vtime;
+static unsigned long *wsclock_last;
+
+static void wsclock_init(int n){
+  nframes = n;
+  wsclock_hand = 0;
+  wsclock_vtime = 0;
+  wsclock_tau = tau > 0 ? tau : n;
+  free(wsclock_last);
+  wsclock_last = calloc(n, sizeof(unsigned long));
+}
+
+static void wsclock_on_fault(int frame, pid_t pid, int page){
+  wsclock_last[frame] = __atomic_add_fetch(&wsclock_vtime, 1, __ATOMIC_RELAXED);
+}
+
+static void wsclock_on_access(int frame){
+  wsclock_last[frame] = __atomic_add_fetch(&wsclock_vtime, 1, __ATOMIC_RELAXED);
+}
+
+static int wsclock_select(void){
+  int old_dirty = -1;
+  int unreferenced = -1;
+  unsigned long now = __atomic_load_n(&wsclock_vtime, __ATOMIC_RELAXED);
+  for (int n = 0; n < nframes; n++){
+    int f = wsclock_hand;
+    wsclock_hand = (wsclock_hand+1) % nframes;
+    int ref = pager_frame_age(f);
+    if (ref == -1)
+      continue;
+    if (ref == 1){
+      wsclock_last[f] = now;
+      continue;
+    }
+    if (now - wsclock_last[f] > wsclock_tau){
+      if (pager_frame_dirty(f) == 0)
+        return f;
+      if (old_dirty == -1)
+        old_dirty = f;
+    }
+    if (unreferenced == -1)
+      unreferenced = f;
+  }
+  return old_dirty != -1 ? old_dirty : unreferenced;
+}
+
+/****************************************************************************
+ * arc: adaptive replacement driven by reference bits, in the CAR
+ * formulation (T1/T2 are clocks, B1/B2 ghost lists, `p` the target
+ * size of T1).  The MMU only observes accesses through faults, so
+ * hits are sampled from reference bits as the clocks sweep.
+ ***************************************************************************/
+static struct frame_list arc_t1, arc_t2;
+static struct ghost_list arc_b1, arc_b2;
+static int arc_p;
+
+static void arc_init(int n){
+  nframes = n;
+  frame_lists_init();
+  ghost_init(2*n+1);
+  flist_init(&arc_t1);
+  flist_init(&arc_t2);
+  ghost_list_init(&arc_b1);
+  ghost_list_init(&arc_b2);
+  arc_p = 0;
+}
+
+static void arc_on_fault(int frame, pid_t pid, int page){
+  int g = ghost_find(pid, page);
+  if (g == -1){
+    if (arc_t1.count + arc_b1.count >= nframes && arc_b1.count > 0)
+      ghost_remove(arc_b1.head);
+    else if (arc_t1.count + arc_t2.count + arc_b1.count + arc_b2.count >= 2*nframes && arc_b2.count > 0)
+      ghost_remove(arc_b2.head);
+    flist_append(&arc_t1, frame);
+  } else {
+    if (ghosts[g].list == &arc_b1)
+      arc_p = min(arc_p + max(1, arc_b2.count / arc_b1.count), nframes);
+    else
+      arc_p = max(arc_p - max(1, arc_b1.count / arc_b2.count), 0);
+    ghost_remove(g);
+    flist_append(&arc_t2, frame);
+  }
+}
+
+static void arc_on_evict(int frame, pid_t pid, int page){
+  struct frame_list *l = flist_of[frame];
+  if (l == NULL)
+    return;
+  flist_remove(frame);
+  if (page == -1)
+    return;
+  if (l == &arc_t1)
+    ghost_add(&arc_b1, &arc_b2, pid, page);
+  else
+    ghost_add(&arc_b2, &arc_b1, pid, page);
+}
+
+static int arc_select(void){
+  for (int n = 0; n < 4*nframes; n++){
+    struct frame_list *l = &arc_t2;
+    if ((arc_t1.count > 0 && arc_t1.count >= max(1, arc_p)) || arc_t2.count == 0)
+      l = &arc_t1;
+    if (l->count == 0)
+      return -1;
+    int f = l->head;
+    int ref = pager_frame_age(f);
+    if (ref == 0)
+      return f;
+    flist_remove(f);
+    flist_append(ref == 1 ? &arc_t2 : l, f);
+  }
+  return -1;
+}
+
+/****************************************************************************
+ * clockpro: CLOCK-Pro.  Resident pages are hot or cold; cold pages
+ * are in a test period after being (re)loaded.  A cold page accessed
+ * during its test period becomes hot; evicted cold pages in test are
+ * remembered as non-resident ghosts, and a fault on one of them grows
+ * the cold target `m_c`.  The hot hand demotes unreferenced hot
+ * pages to keep at most nframes - m_c of them.
+ ***************************************************************************/
+static char *cp_resident;
+static char *cp_hot;
+static char *cp_test;
+static int cp_nres;
+static int cp_nhot;
+static int cp_mc;
+static int cp_hand_cold;
+static int cp_hand_hot;
+static struct ghost_list cp_tested;
+
+static void clockpro_init(int n){
+  nframes = n;
+  free(cp_resident);
+  free(cp_hot);
+  free(cp_test);
+  cp_resident = calloc(n, 1);
+  cp_hot = calloc(n, 1);
+  cp_test = calloc(n, 1);
+  ghost_init(n+1);
+  ghost_list_init(&cp_tested);
+  cp_nres = 0;
+  cp_nhot = 0;
+  cp_mc = max(1, n/8);
+  cp_hand_cold = 0;
+  cp_hand_hot = 0;
+}
+
+static void clockpro_run_hand_hot(void){
+  for (int n = 0; cp_nhot > nframes - cp_mc && n < 2*nframes; n++){
+    int f = cp_hand_hot;
+    cp_hand_hot = (cp_hand_hot+1) % nframes;
+    if (!cp_resident[f] || !cp_hot[f])
+      continue;
+    if (pager_frame_age(f) != 0)
+      continue;
+    cp_hot[f] = 0;
+    cp_test[f] = 0;
+    cp_nhot--;
+  }
+}
+
+static void clockpro_on_fault(int frame, pid_t pid, int page){
+  cp_resident[frame] = 1;
+  cp_nres++;
+  int g = ghost_find(pid, page);
+  if (g != -1){
+    ghost_remove(g);
+    cp_mc = min(cp_mc+1, max(1, nframes-1));
+    cp_hot[frame] = 1;
+    cp_test[frame] = 0;
+    cp_nhot++;
+    clockpro_run_hand_hot();
+  } else {
+    cp_hot[frame] = 0;
+    cp_test[frame] = 1;
+  }
+}
+
+static void clockpro_on_evict(int frame, pid_t pid, int page){
+  if (!cp_resident[frame])
+    return;
+  cp_resident[frame] = 0;
+  cp_nres--;
+  if (cp_hot[frame])
+    cp_nhot--;
+  if (cp_test[frame] && page != -1){
+    ghost_add(&cp_tested, &cp_tested, pid, page);
+    if (cp_tested.count > nframes){
+      ghost_remove(cp_tested.head);
+      cp_mc = max(cp_mc-1, 1);
+    }
+  }
+  cp_hot[frame] = 0;
+  cp_test[frame] = 0;
+}
+
+static int clockpro_select(void){
+  for (int n = 0; n < 4*nframes; n++){
+    int f = cp_hand_cold;
+    cp_hand_cold = (cp_hand_cold+1) % nframes;
+    if (!cp_resident[f])
+      continue;
+    if (cp_hot[f]){
+      /* cold pages may all be in flight, so give up on them after
+       * two sweeps */
+      if (cp_nhot < cp_nres && n < 2*nframes)
+        continue;
+      /* every resident page is hot: demote this one */
+      cp_hot[f] = 0;
+      cp_nhot--;
+    }
+    int ref = pager_frame_age(f);
+    if (ref == -1)
+      continue;
+    if (ref == 0)
+      return f;
+    if (cp_test[f]){
+      cp_hot[f] = 1;
+      cp_test[f] = 0;
+      cp_nhot++;
+      clockpro_run_hand_hot();
+    } else {
+      cp_test[f] = 1;
+    }
+  }
+  return -1;
+}
+
+/****************************************************************************
+ * policy table and options
+ ***************************************************************************/
+static const struct policy policies[] = {
+  { "clock", clock_init, NULL, NULL, NULL, clock_select },
+  { "clock2", clock2_init, NULL, NULL, NULL, clock2_select },
+  { "clockpro", clockpro_init, clockpro_on_fault, NULL, clockpro_on_evict, clockpro_select },
+  { "arc", arc_init, arc_on_fault, NULL, arc_on_evict, arc_select },
+  { "wsclock", wsclock_init, wsclock_on_fault, wsclock_on_access, NULL, wsclock_select },
+};
+
+const char *policy_names = "clock clock2 clockpro arc wsclock";
+
+const struct policy *policy_find(const char *name){
+  for (int i = 0; i < sizeof(policies)/sizeof(policies[0]); i++){
+    if (strcmp(policies[i].name, name) == 0)
+      return &policies[i];
+  }
+  return NULL;
+}
+
+int policy_option(const char *name, const char *value){
+  int v = atoi(value);
+  if (strcmp(name, "handspread") == 0 && v > 0){
+    handspread = v;
+    return 0;
+  }
+  if (strcmp(name, "tau") == 0 && v > 0){
+    tau = v;
+    return 0;
+  }
+  return -1;
+}
@@ -0,0 +1,67 @@
+#ifndef __POLICY_HEADER__
+#define __POLICY_HEADER__
+
+#include <sys/types.h>
+
+/* Page replacement policies.  The pager keeps reference and dirty
+ * information for each frame and performs evictions; a policy only
+ * decides which frame to evict.  Policies are selected by name with
+ * `pager_option("policy", name)` (the `-p` flag to the MMU).
+ *
+ * `on_fault`, `on_evict` and `select_victim` are called with the
+ * pager's clock lock held, so they are serialized with each other.
+ * `on_access` runs concurrently from faults of different processes
+ * and must only do lock-free per-frame updates.  Hooks a policy does
+ * not need may be NULL. */
+struct policy {
+	const char *name;
+	/* `init` (re)initializes the policy for `nframes` frames. */
+	void (*init)(int nframes);
+	/* `on_fault` is called when page `page` of process `pid` is
+	 * brought into `frame` by a page fault. */
+	void (*on_fault)(int frame, pid_t pid, int page);
+	/* `on_access` is called when a resident page in `frame` faults
+	 * because it lacked access rights. */
+	void (*on_access)(int frame);
+	/* `on_evict` is called after the page in `frame` is paged out.
+	 * `page` is -1 if the frame was freed because process `pid`
+	 * exited, in which case no history should be kept. */
+	void (*on_evict)(int frame, pid_t pid, int page);
+	/* `select_victim` returns the frame the pager should try to
+	 * evict, or -1 if no frame is currently evictable.  The pager
+	 * evicts the frame only if it is still unreferenced. */
+	int (*select_victim)(void);
+};
+
+/* `policy_find` returns the policy called `name`, or NULL. */
+const struct policy *policy_find(const char *name);
+
+/* `policy_option` sets a tunable of the policies (e.g., the hand
+ * spread of the two-handed clock).  Returns -1 if `name` is unknown
+ * or `value` invalid. */
+int policy_option(const char *name, const char *value);
+
+/* `policy_names` lists the available policies, separated by spaces. */
+extern const char *policy_names;
+
+/* Frame state exported by the pager to the policies.  These return -1
+ * if `frame` is free, being filled, or owned by an exiting process.
+ *
+ * `pager_frame_test` returns the frame's reference bit.
+ * `pager_frame_age` returns the reference bit and clears it; the page
+ * loses access rights so its next access faults and sets it again.
+ * With the pager's `protvec` option, access is only revoked once
+ * `select_victim` or `on_fault` returns, for all aged pages of a
+ * process at once.
+ * `pager_frame_dirty` returns 1 if the frame differs from its block. */
+int pager_frame_test(int frame);
+int pager_frame_age(int frame);
+int pager_frame_dirty(int frame);
+
+/* `pager_frame_scan` returns the first frame in [`from`, `to`) that is
+ * resident and unreferenced, or -1 if there is none.  It ages every
+ * referenced frame before it, in index order, as a clock hand would;
+ * frames are skipped a 64-bit word of the pager's bitmaps at a time. */
+int pager_frame_scan(int from, int to);
+
+#endif
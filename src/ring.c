@@ -0,0 +1,112 @@
+#define _GNU_SOURCE
+#include <linux/futex.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ring.h"
+
+static int ring_sleep(uint32_t *addr, uint32_t val, uint32_t *sleepers, int sock);
+static void ring_wake(uint32_t *addr);
+static int ring_peer_gone(int sock);
+
+/*****************************************************************************
+ * public function implementations
+ ****************************************************************************/
+ssize_t ring_read(struct ring *r, void *buf, size_t len, int flags, int sock) /* {{{ */
+{
+	uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+	uint32_t head;
+	while((head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) - tail < len) {
+		if(flags & MSG_DONTWAIT) {
+			errno = EAGAIN;
+			return -1;
+		}
+		if(ring_sleep(&r->head, head, &r->readers, sock)) return 0;
+	}
+	size_t at = tail & (RING_SIZE - 1);
+	size_t n = len < RING_SIZE - at ? len : RING_SIZE - at;
+	memcpy(buf, r->data + at, n);
+	memcpy((char *)buf + n, r->data, len - n);
+	if(flags & MSG_PEEK) return len;
+	__atomic_store_n(&r->tail, tail + len, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&r->writers, __ATOMIC_SEQ_CST)) ring_wake(&r->tail);
+	return len;
+} /* }}} */
+
+ssize_t ring_write(struct ring *r, const void *buf, size_t len, int sock) /* {{{ */
+{
+	if(len > RING_SIZE) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	uint32_t head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+	uint32_t tail;
+	while(head - (tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)) > RING_SIZE - len) {
+		if(ring_sleep(&r->tail, tail, &r->writers, sock)) {
+			errno = EPIPE;
+			return -1;
+		}
+	}
+	size_t at = head & (RING_SIZE - 1);
+	size_t n = len < RING_SIZE - at ? len : RING_SIZE - at;
+	memcpy(r->data + at, buf, n);
+	memcpy(r->data, (const char *)buf + n, len - n);
+	__atomic_store_n(&r->head, head + len, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&r->readers, __ATOMIC_SEQ_CST)) ring_wake(&r->head);
+	if(__atomic_load_n(&r->doorbell, __ATOMIC_SEQ_CST)
+			&& __atomic_exchange_n(&r->doorbell, 0, __ATOMIC_SEQ_CST)) {
+		char bell = 0;
+		if(send(sock, &bell, sizeof(bell), MSG_NOSIGNAL) != sizeof(bell))
+			return -1;
+	}
+	return len;
+} /* }}} */
+
+/* The writer publishes =head= before it looks at =doorbell=, and we set
+ * =doorbell= before we look at =head=, so either we see the bytes or the
+ * writer sees the request.  If both happen, whoever clears =doorbell=
+ * first decides whether the bell rings. */
+int ring_doorbell(struct ring *r) /* {{{ */
+{
+	__atomic_store_n(&r->doorbell, 1, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&r->head, __ATOMIC_SEQ_CST)
+			== __atomic_load_n(&r->tail, __ATOMIC_RELAXED))
+		return 0;
+	return __atomic_exchange_n(&r->doorbell, 0, __ATOMIC_SEQ_CST);
+} /* }}} */
+
+/*****************************************************************************
+ * static function implementations
+ ****************************************************************************/
+/* Sleeps while =*addr= holds =val=, for at most RING_POLL_MS, counted in
+ * =sleepers= so the other side knows to wake us.  Returns 1 if we timed
+ * out and the peer at the other end of =sock= is gone. */
+static int ring_sleep(uint32_t *addr, uint32_t val, uint32_t *sleepers, int sock) /* {{{ */
+{
+	struct timespec ts = { 0, RING_POLL_MS * 1000000L };
+	__atomic_add_fetch(sleepers, 1, __ATOMIC_SEQ_CST);
+	long rc = syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+	int timedout = rc == -1 && errno == ETIMEDOUT;
+	__atomic_sub_fetch(sleepers, 1, __ATOMIC_SEQ_CST);
+	return timedout && ring_peer_gone(sock);
+} /* }}} */
+
+static void ring_wake(uint32_t *addr) /* {{{ */
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+} /* }}} */
+
+/* A hangup is reported even while doorbell bytes are still unread. */
+static int ring_peer_gone(int sock) /* {{{ */
+{
+	struct pollfd p = { .fd = sock, .events = POLLRDHUP };
+	if(poll(&p, 1, 0) != 1) return 0;
+	return (p.revents & (POLLRDHUP | POLLHUP | POLLERR | POLLNVAL)) != 0;
+} /* }}} */
@@ -0,0 +1,61 @@
+/* This module implements the shared-memory transport between clients and
+ * the MMU.  Each direction is a byte stream kept in a ring buffer with a
+ * single producer and a single consumer; a client's two rings live in a
+ * memfd it creates and passes to the MMU (see MMU_PROTO_RING_REQ).
+ * Messages are the same as on the socket, so =ring_read= and =ring_write=
+ * stand in for recv(2) and send(2).
+ *
+ * A reader that finds too few bytes sleeps on a futex on =head=, and a
+ * writer that finds too little space sleeps on =tail=; the other side
+ * only calls futex(2) when it sees a sleeper.  The MMU serves clients
+ * from epoll, which cannot wait on a futex: before it stops looking at a
+ * ring it sets =doorbell=, and the next =ring_write= clears it and writes
+ * a byte to the client's socket instead.  The socket also tells either
+ * side when the other is gone: sleepers wake up every RING_POLL_MS
+ * milliseconds to check it for a hangup. */
+
+#ifndef __RING_HEADER__
+#define __RING_HEADER__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define RING_SIZE (1 << 16) /* holds the acknowledgements of a full window */
+#define RING_POLL_MS 100
+
+struct ring {
+	uint32_t head; /* bytes written */
+	uint32_t tail; /* bytes read */
+	uint32_t readers; /* asleep on head */
+	uint32_t writers; /* asleep on tail */
+	uint32_t doorbell;
+	char pad[64 - 5 * sizeof(uint32_t)];
+	char data[RING_SIZE];
+};
+
+/* The rings of a client.  A zero-filled =ring_shm= is ready to use. */
+struct ring_shm {
+	struct ring req; /* client to MMU */
+	struct ring rep; /* MMU to client */
+};
+
+/* This function copies =len= bytes from =r= into =buf=, sleeping until
+ * they are available.  =flags= may have MSG_PEEK, to leave the bytes in
+ * the ring, and MSG_DONTWAIT, to fail with errno set to EAGAIN instead of
+ * sleeping.  Returns =len=, 0 if the peer at the other end of =sock= is
+ * gone, or -1.  Only one thread may read a ring at a time. */
+ssize_t ring_read(struct ring *r, void *buf, size_t len, int flags, int sock);
+
+/* This function copies =len= bytes, at most RING_SIZE, from =buf= into
+ * =r=, sleeping while the ring is full, and rings the doorbell on =sock=
+ * if the reader asked for it.  Returns =len=, or -1 if the peer is gone.
+ * Only one thread may write a ring at a time. */
+ssize_t ring_write(struct ring *r, const void *buf, size_t len, int sock);
+
+/* This function asks the writer of =r= to ring the doorbell on its next
+ * write.  Returns 0, or 1, withdrawing the request, if the ring already
+ * holds bytes the doorbell will not announce. */
+int ring_doorbell(struct ring *r);
+
+#endif
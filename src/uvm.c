@@ -2,6 +2,7 @@
  * DEPARTAMENTO DE CIENCIA DA COMPUTACAO    *
  * Copyright (c) Italo Fernando Scota Cunha */
 
+#define _GNU_SOURCE
 #include "uvm.h"
 
 #include <sys/mman.h>
@@ -19,12 +20,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <ucontext.h>
 #include <unistd.h>
 
 #include "log.h"
 
 #include "mmu.h"
 #include "mmuproto.h"
+#include "ring.h"
 
 /****************************************************************************
  * structure definitions and static variables
@@ -36,6 +39,8 @@ struct uvm_data {/*{{{*/
 	pthread_t thread;
 	pthread_mutex_t mutex;
 	pthread_cond_t cond;
+	struct ring_shm *ring; /* NULL when talking over the socket */
+	pthread_mutex_t send_lock; /* one writer on the request ring */
 	char *pmem_fn;
 	int pmem_fd;
 	intptr_t result;
@@ -56,9 +61,18 @@ static void uvm_proto_syslog_rep(void);
 static void uvm_proto_segv_rep(void);
 static void uvm_proto_remap_rep(void);
 static void uvm_proto_chprot_rep(void);
+static void uvm_proto_remap_vec_rep(void);
+static void uvm_proto_chprot_vec_rep(void);
+static void uvm_proto_quota_rep(void);
+static void uvm_proto_extend_n_rep(void);
+static void uvm_proto_release_rep(void);
 
 /* Helper functions */
 static void uvm_connect_socket(int sock, const struct sockaddr_un * addr);
+static void uvm_ring_create(void);
+static ssize_t uvm_send(const void *buf, size_t len);
+static ssize_t uvm_recv(void *buf, size_t len, int flags);
+static uint32_t uvm_segv_access(void *context);
 
 #define NUM_CONNECTION_TRIES 3
 
@@ -80,6 +94,8 @@ void uvm_create(void)/*{{{*/
 	if(!uvm) prexit();
 	uvm->running = 1;
 	uvm->npages = 0;
+	uvm->ring = NULL;
+	pthread_mutex_init(&uvm->send_lock, NULL);
 
 	logd(LOG_DEBUG, "  connecting unix socket [%s]\n", MMU_PROTO_UNIX_PATH);
 	uvm->sock = socket(AF_UNIX, SOCK_STREAM, 0);
@@ -96,14 +112,17 @@ void uvm_create(void)/*{{{*/
 	struct mmu_proto_create_req req;
 	req.type = MMU_PROTO_CREATE_REQ;
 	req.pid = (uint32_t)getpid();
-	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req))
+	if(uvm_send(&req, sizeof(req)) != sizeof(req))
 		prexit();
 
 	logd(LOG_DEBUG, "  waiting CREATE_REP\n");
 	struct mmu_proto_create_rep rep;
-	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep)) prexit();
+	if(uvm_recv(&rep, sizeof(rep), 0) != sizeof(rep)) prexit();
 	assert(rep.type == MMU_PROTO_CREATE_REP);
 
+	const char *transport = getenv("UVM_TRANSPORT");
+	if(transport && !strcmp(transport, "ring")) uvm_ring_create();
+
 	uvm->pmem_fn = strndup(rep.pmem_fn, MMU_PROTO_PATH_MAX);
 	logd(LOG_DEBUG, "  mapping pmem_fn [%s]\n", uvm->pmem_fn);
 	uvm->pmem_fd = open(uvm->pmem_fn, O_RDWR);
@@ -133,7 +152,7 @@ void * uvm_extend(void) {/*{{{*/
 	pthread_mutex_lock(&uvm->mutex);
 	struct mmu_proto_extend_req req;
 	req.type = MMU_PROTO_EXTEND_REQ;
-	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req))
+	if(uvm_send(&req, sizeof(req)) != sizeof(req))
 		prexit();
 	pthread_cond_wait(&uvm->cond, &uvm->mutex);
 	if(uvm->result) uvm->npages++;
@@ -141,6 +160,24 @@ void * uvm_extend(void) {/*{{{*/
 	return (void *)uvm->result;
 }/*}}}*/
 
+void * uvm_extend_n(size_t count) {/*{{{*/
+	if(count == 0 || count > UINT32_MAX) {
+		errno = count == 0 ? EINVAL : ENOSPC;
+		return NULL;
+	}
+	pthread_mutex_lock(&uvm->mutex);
+	struct mmu_proto_extend_n_req req;
+	req.type = MMU_PROTO_EXTEND_N_REQ;
+	req.count = (uint32_t)count;
+	if(uvm_send(&req, sizeof(req)) != sizeof(req))
+		prexit();
+	pthread_cond_wait(&uvm->cond, &uvm->mutex);
+	if(uvm->result) uvm->npages += count;
+	else errno = ENOSPC;
+	pthread_mutex_unlock(&uvm->mutex);
+	return (void *)uvm->result;
+}/*}}}*/
+
 int uvm_syslog(void *addr, size_t len)/*{{{*/
 {
 	pthread_mutex_lock(&uvm->mutex);
@@ -148,7 +185,41 @@ int uvm_syslog(void *addr, size_t len)/*{{{*/
 	req.type = MMU_PROTO_SYSLOG_REQ;
 	req.addr = (intptr_t)addr;
 	req.len = len;
-	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req))
+	if(uvm_send(&req, sizeof(req)) != sizeof(req))
+		prexit();
+	pthread_cond_wait(&uvm->cond, &uvm->mutex);
+	if(uvm->result != 0) errno = EINVAL;
+	pthread_mutex_unlock(&uvm->mutex);
+	return (int)uvm->result;
+}/*}}}*/
+
+int uvm_release(void *addr, size_t npages)/*{{{*/
+{
+	if(npages == 0 || npages > UINT32_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+	pthread_mutex_lock(&uvm->mutex);
+	struct mmu_proto_release_req req;
+	req.type = MMU_PROTO_RELEASE_REQ;
+	req.addr = (intptr_t)addr;
+	req.npages = (uint32_t)npages;
+	if(uvm_send(&req, sizeof(req)) != sizeof(req))
+		prexit();
+	pthread_cond_wait(&uvm->cond, &uvm->mutex);
+	if(uvm->result != 0) errno = EINVAL;
+	pthread_mutex_unlock(&uvm->mutex);
+	return (int)uvm->result;
+}/*}}}*/
+
+int uvm_set_quota(int min, int max)/*{{{*/
+{
+	pthread_mutex_lock(&uvm->mutex);
+	struct mmu_proto_quota_req req;
+	req.type = MMU_PROTO_QUOTA_REQ;
+	req.min = min;
+	req.max = max;
+	if(uvm_send(&req, sizeof(req)) != sizeof(req))
 		prexit();
 	pthread_cond_wait(&uvm->cond, &uvm->mutex);
 	if(uvm->result != 0) errno = EINVAL;
@@ -169,7 +240,7 @@ void * uvm_thread(void *data) {/*{{{*/
 	while(uvm->running) {
 		logd(LOG_DEBUG, "uvm_thread waiting message\n");
 		uint32_t type;
-		ssize_t c = recv(uvm->sock, &type, sizeof(type), MSG_PEEK);
+		ssize_t c = uvm_recv(&type, sizeof(type), MSG_PEEK);
 		if(!uvm->running) break;
 		if(c != sizeof(type)) prexit();
 		pthread_mutex_lock(&uvm->mutex);
@@ -189,6 +260,21 @@ void * uvm_thread(void *data) {/*{{{*/
 			case MMU_PROTO_CHPROT_REP:
 				uvm_proto_chprot_rep();
 				break;
+			case MMU_PROTO_REMAP_VEC_REP:
+				uvm_proto_remap_vec_rep();
+				break;
+			case MMU_PROTO_CHPROT_VEC_REP:
+				uvm_proto_chprot_vec_rep();
+				break;
+			case MMU_PROTO_QUOTA_REP:
+				uvm_proto_quota_rep();
+				break;
+			case MMU_PROTO_EXTEND_N_REP:
+				uvm_proto_extend_n_rep();
+				break;
+			case MMU_PROTO_RELEASE_REP:
+				uvm_proto_release_rep();
+				break;
 			case MMU_PROTO_EXIT_REP:
 				uvm->running = 0;
 				break;
@@ -208,10 +294,12 @@ void uvm_exit(int status, void *arg)/*{{{*/
 	struct mmu_proto_exit_req req;
 	req.type = MMU_PROTO_EXIT_REQ;
 	/* socket may have been closed by the MMU, ignore return value: */
-	send(uvm->sock, &req, sizeof(req), 0);
+	uvm_send(&req, sizeof(req));
 	pthread_mutex_unlock(&(uvm->mutex));
 	pthread_join(uvm->thread, NULL);
 	close(uvm->sock);
+	if(uvm->ring) munmap(uvm->ring, sizeof(*uvm->ring));
+	pthread_mutex_destroy(&uvm->send_lock);
 
 	pthread_mutex_destroy(&uvm->mutex);
 	pthread_cond_destroy(&uvm->cond);
@@ -247,7 +335,8 @@ void uvm_segv_action(int signum, siginfo_t *si, void *context)/*{{{*/
 	req.type = MMU_PROTO_SEGV_REQ;
 	req.addr = (intptr_t)si->si_addr;
 	req.code = si->si_code;
-	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req)) prexit();
+	req.access = uvm_segv_access(context);
+	if(uvm_send(&req, sizeof(req)) != sizeof(req)) prexit();
 
 	logd(LOG_DEBUG, "%s waiting service at condition variable\n", __func__);
 	pthread_cond_wait(&uvm->cond, &uvm->mutex);
@@ -255,6 +344,20 @@ void uvm_segv_action(int signum, siginfo_t *si, void *context)/*{{{*/
 	logd(LOG_DEBUG, "%s returning\n", __func__);
 }/*}}}*/
 
+/* Recovers the kind of access from the page-fault error code the
+ * kernel saves in the signal context (bit 1 is set for writes). */
+uint32_t uvm_segv_access(void *context)/*{{{*/
+{
+	#if defined(__x86_64__) || defined(__i386__)
+	ucontext_t *uc = context;
+	if(uc->uc_mcontext.gregs[REG_ERR] & 0x2)
+		return MMU_PROTO_ACCESS_WRITE;
+	return MMU_PROTO_ACCESS_READ;
+	#else
+	return MMU_PROTO_ACCESS_UNKNOWN;
+	#endif
+}/*}}}*/
+
 /****************************************************************************
  * protocol message handlers
  ***************************************************************************/
@@ -262,29 +365,62 @@ void uvm_proto_extend_rep(void)/*{{{*/
 {
 	logd(LOG_DEBUG, "processing EXTEND_REP\n");
 	struct mmu_proto_extend_rep rep;
-	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
+	if(uvm_recv(&rep, sizeof(rep), 0) != sizeof(rep))
 		prexit();
 	assert(rep.type == MMU_PROTO_EXTEND_REP);
 	uvm->result = (intptr_t)rep.vaddr;
 	pthread_cond_signal(&uvm->cond);
 }/*}}}*/
 
+void uvm_proto_extend_n_rep(void)/*{{{*/
+{
+	logd(LOG_DEBUG, "processing EXTEND_N_REP\n");
+	struct mmu_proto_extend_n_rep rep;
+	if(uvm_recv(&rep, sizeof(rep), 0) != sizeof(rep))
+		prexit();
+	assert(rep.type == MMU_PROTO_EXTEND_N_REP);
+	uvm->result = (intptr_t)rep.vaddr;
+	pthread_cond_signal(&uvm->cond);
+}/*}}}*/
+
+void uvm_proto_release_rep(void)/*{{{*/
+{
+	logd(LOG_DEBUG, "processing RELEASE_REP\n");
+	struct mmu_proto_release_rep rep;
+	if(uvm_recv(&rep, sizeof(rep), 0) != sizeof(rep))
+		prexit();
+	assert(rep.type == MMU_PROTO_RELEASE_REP);
+	uvm->result = rep.retcode;
+	pthread_cond_signal(&uvm->cond);
+}/*}}}*/
+
 void uvm_proto_syslog_rep(void)/*{{{*/
 {
 	logd(LOG_DEBUG, "processing SYSLOG_REP\n");
 	struct mmu_proto_syslog_rep rep;
-	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
+	if(uvm_recv(&rep, sizeof(rep), 0) != sizeof(rep))
 		prexit();
 	assert(rep.type == MMU_PROTO_SYSLOG_REP);
 	uvm->result = (intptr_t)rep.retcode;
 	pthread_cond_signal(&uvm->cond);
 }/*}}}*/
 
+void uvm_proto_quota_rep(void)/*{{{*/
+{
+	logd(LOG_DEBUG, "processing QUOTA_REP\n");
+	struct mmu_proto_quota_rep rep;
+	if(uvm_recv(&rep, sizeof(rep), 0) != sizeof(rep))
+		prexit();
+	assert(rep.type == MMU_PROTO_QUOTA_REP);
+	uvm->result = (intptr_t)rep.retcode;
+	pthread_cond_signal(&uvm->cond);
+}/*}}}*/
+
 void uvm_proto_segv_rep(void)/*{{{*/
 {
 	logd(LOG_DEBUG, "processing SEGV_REP\n");
 	struct mmu_proto_segv_rep rep;
-	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
+	if(uvm_recv(&rep, sizeof(rep), 0) != sizeof(rep))
 		prexit();
 	assert(rep.type == MMU_PROTO_SEGV_REP);
 	pthread_cond_signal(&uvm->cond);
@@ -294,7 +430,7 @@ void uvm_proto_remap_rep(void)/*{{{*/
 {
 	logd(LOG_DEBUG, "processing REMAP_REP\n");
 	struct mmu_proto_remap_rep rep;
-	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
+	if(uvm_recv(&rep, sizeof(rep), 0) != sizeof(rep))
 		prexit();
 	assert(rep.type == MMU_PROTO_REMAP_REP);
 	assert(rep.prot != PROT_NONE);
@@ -320,14 +456,15 @@ void uvm_proto_remap_rep(void)/*{{{*/
 
 	struct mmu_proto_remap_req req;
 	req.type = MMU_PROTO_REMAP_REQ;
-	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req)) prexit();
+	req.seq = rep.seq;
+	if(uvm_send(&req, sizeof(req)) != sizeof(req)) prexit();
 }/*}}}*/
 
 void uvm_proto_chprot_rep(void)/*{{{*/
 {
 	logd(LOG_DEBUG, "processing CHPROT_REP\n");
 	struct mmu_proto_chprot_rep rep;
-	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
+	if(uvm_recv(&rep, sizeof(rep), 0) != sizeof(rep))
 		prexit();
 	assert(rep.type == MMU_PROTO_CHPROT_REP);
 
@@ -346,7 +483,88 @@ void uvm_proto_chprot_rep(void)/*{{{*/
 
 	struct mmu_proto_chprot_req req;
 	req.type = MMU_PROTO_CHPROT_REQ;
-	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req)) prexit();
+	req.seq = rep.seq;
+	if(uvm_send(&req, sizeof(req)) != sizeof(req)) prexit();
+}/*}}}*/
+
+/* Entries of vectored changes follow the header.  Pagers list pages
+ * in address order, so runs of adjacent pages with the same protection
+ * (and, for remaps, adjacent frames) are applied with one call. */
+void uvm_proto_remap_vec_rep(void)/*{{{*/
+{
+	logd(LOG_DEBUG, "processing REMAP_VEC_REP\n");
+	struct mmu_proto_vec_rep rep;
+	struct mmu_proto_remap_ent e[MMU_PROTO_VEC_MAX];
+	if(uvm_recv(&rep, sizeof(rep), MSG_WAITALL) != sizeof(rep))
+		prexit();
+	assert(rep.type == MMU_PROTO_REMAP_VEC_REP);
+	if(rep.count > MMU_PROTO_VEC_MAX) prexit();
+	ssize_t len = rep.count * sizeof(e[0]);
+	if(uvm_recv(e, len, MSG_WAITALL) != len) prexit();
+
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	for(uint32_t i = 0, j; i < rep.count; i = j) {
+		assert(e[i].prot != PROT_NONE && e[i].vaddr < UINTPTR_MAX);
+		if((e[i].vaddr % pagesz) != 0) {
+			logd(LOG_FATAL, "error: unaligned remap of vaddr %p\n",
+					(void *)(uintptr_t)e[i].vaddr);
+			prexit();
+		}
+		for(j = i + 1; j < rep.count; j++) {
+			uint64_t k = j - i;
+			if(e[j].vaddr != e[i].vaddr + k*pagesz
+					|| e[j].offset != e[i].offset + k*pagesz
+					|| e[j].prot != e[i].prot)
+				break;
+		}
+		void *addr = (void *)(uintptr_t)e[i].vaddr;
+		size_t size = (j - i) * pagesz;
+		int prot = (int)e[i].prot;
+		logd(LOG_DEBUG, "remapping %p pages %u at offset %llu prot %d\n",
+				addr, j - i, (unsigned long long)e[i].offset, prot);
+		munmap(addr, size);
+		void *r = mmap(addr, size, prot, MAP_SHARED, uvm->pmem_fd,
+				(off_t)e[i].offset);
+		if(r != addr)
+			prexit();
+	}
+
+	struct mmu_proto_remap_req req;
+	req.type = MMU_PROTO_REMAP_REQ;
+	req.seq = rep.seq;
+	if(uvm_send(&req, sizeof(req)) != sizeof(req)) prexit();
+}/*}}}*/
+
+void uvm_proto_chprot_vec_rep(void)/*{{{*/
+{
+	logd(LOG_DEBUG, "processing CHPROT_VEC_REP\n");
+	struct mmu_proto_vec_rep rep;
+	struct mmu_proto_chprot_ent e[MMU_PROTO_VEC_MAX];
+	if(uvm_recv(&rep, sizeof(rep), MSG_WAITALL) != sizeof(rep))
+		prexit();
+	assert(rep.type == MMU_PROTO_CHPROT_VEC_REP);
+	if(rep.count > MMU_PROTO_VEC_MAX) prexit();
+	ssize_t len = rep.count * sizeof(e[0]);
+	if(uvm_recv(e, len, MSG_WAITALL) != len) prexit();
+
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	for(uint32_t i = 0, j; i < rep.count; i = j) {
+		assert(e[i].vaddr < UINTPTR_MAX);
+		for(j = i + 1; j < rep.count; j++)
+			if(e[j].vaddr != e[i].vaddr + (uint64_t)(j - i)*pagesz
+					|| e[j].prot != e[i].prot)
+				break;
+		void *addr = (void *)(uintptr_t)e[i].vaddr;
+		int prot = (int)e[i].prot;
+		logd(LOG_DEBUG, "mprotect %p pages %u prot %d\n", addr, j - i, prot);
+		if(mprotect(addr, (j - i) * pagesz, prot) == -1)
+			prexit();
+	}
+
+	struct mmu_proto_chprot_req req;
+	req.type = MMU_PROTO_CHPROT_REQ;
+	req.seq = rep.seq;
+	if(uvm_send(&req, sizeof(req)) != sizeof(req)) prexit();
 }/*}}}*/
 
 /****************************************************************************
@@ -370,3 +588,60 @@ void uvm_connect_socket(int sock, const struct sockaddr_un * addr) {
 		prexit();
 	}
 }
+
+/* Creates the rings in a memfd and passes it to the MMU.  If the MMU
+ * turns them down, we stay on the socket. */
+void uvm_ring_create(void)/*{{{*/
+{
+	logd(LOG_DEBUG, "  creating rings\n");
+	int fd = memfd_create("uvm.ring", MFD_CLOEXEC);
+	if(fd == -1) prexit();
+	if(ftruncate(fd, sizeof(struct ring_shm)) == -1) prexit();
+	struct ring_shm *ring = mmap(NULL, sizeof(*ring), PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	if(ring == MAP_FAILED) prexit();
+
+	logd(LOG_DEBUG, "  sending RING_REQ\n");
+	struct mmu_proto_ring_req req;
+	req.type = MMU_PROTO_RING_REQ;
+	struct iovec iov = { &req, sizeof(req) };
+	char cbuf[CMSG_SPACE(sizeof(int))];
+	memset(cbuf, 0, sizeof(cbuf));
+	struct msghdr mh = { .msg_iov = &iov, .msg_iovlen = 1,
+			.msg_control = cbuf, .msg_controllen = sizeof(cbuf) };
+	struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+	if(sendmsg(uvm->sock, &mh, 0) != sizeof(req)) prexit();
+	close(fd);
+
+	logd(LOG_DEBUG, "  waiting RING_REP\n");
+	struct mmu_proto_ring_rep rep;
+	if(recv(uvm->sock, &rep, sizeof(rep), MSG_WAITALL) != sizeof(rep))
+		prexit();
+	assert(rep.type == MMU_PROTO_RING_REP);
+	if(rep.retcode != 0) {
+		logd(LOG_DEBUG, "  rings refused, staying on the socket\n");
+		munmap(ring, sizeof(*ring));
+		return;
+	}
+	uvm->ring = ring;
+}/*}}}*/
+
+ssize_t uvm_send(const void *buf, size_t len)/*{{{*/
+{
+	if(!uvm->ring) return send(uvm->sock, buf, len, MSG_NOSIGNAL);
+	pthread_mutex_lock(&uvm->send_lock);
+	ssize_t cnt = ring_write(&uvm->ring->req, buf, len, uvm->sock);
+	pthread_mutex_unlock(&uvm->send_lock);
+	return cnt;
+}/*}}}*/
+
+/* Only `uvm_thread` reads once it is running. */
+ssize_t uvm_recv(void *buf, size_t len, int flags)/*{{{*/
+{
+	if(!uvm->ring) return recv(uvm->sock, buf, len, flags);
+	return ring_read(&uvm->ring->rep, buf, len, flags, uvm->sock);
+}/*}}}*/
@@ -10,7 +10,10 @@
 /* `uvm_create` should be called when a program starts to bind it to
  * the memory management infrastructure.  This function sets up
  * a UNIX socket to communicate with the memory management
- * infrastructure and installs a signal handler for SIGSEGV. */
+ * infrastructure and installs a signal handler for SIGSEGV.  With
+ * `UVM_TRANSPORT=ring` in the environment, messages then go through
+ * rings in memory shared with the infrastructure instead of the
+ * socket. */
 void uvm_create(void);
 
 /* `uvm_extend` allocates a new page for the calling process and
@@ -22,6 +25,22 @@ void uvm_create(void);
  * system page size is given by `sysconf(_SC_PAGESIZE)`. */
 void * uvm_extend(void);
 
+/* `uvm_extend_n` allocates `count` contiguous pages for the calling
+ * process in a single request and returns the address of the first
+ * one.  Either all pages are allocated or none is: on failure it
+ * returns NULL and sets `errno` to ENOSPC (EINVAL if `count` is
+ * zero). */
+void * uvm_extend_n(size_t count);
+
+/* `uvm_release` discards the contents of the `npages` pages starting
+ * at page-aligned `addr`, which must have been allocated with
+ * `uvm_extend` or `uvm_extend_n`.  Their memory is given back to the
+ * MMU, as are their disk blocks if it allocates swap lazily; the
+ * pages remain allocated and read as zeroes when next touched.
+ * Returns 0 on success, or -1 with `errno` set to EINVAL if the range
+ * was not allocated. */
+int uvm_release(void *addr, size_t npages);
+
 /* `uvm_syslog` requests the memory infrastructure to write the
  * string at `addr` with `len` bytes.  Memory at `addr` must be
  * managed by the memory infrastructure (i.e., allocated with
@@ -29,4 +48,12 @@ void * uvm_extend(void);
  * sets `errno` to EINVAL. */
 int uvm_syslog(void *addr, size_t len);
 
+/* `uvm_set_quota` asks the memory infrastructure to keep at least
+ * `min` and at most `max` of the calling process's pages in physical
+ * memory (`max` zero means no limit).  Past `max`, the process's
+ * page faults replace its own pages rather than other processes'.
+ * Returns 0 on success; on failure, returns -1 and sets `errno` to
+ * EINVAL. */
+int uvm_set_quota(int min, int max);
+
 #endif